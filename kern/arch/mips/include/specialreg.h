@@ -87,6 +87,14 @@
 
 #define CIN_INDEXSHIFT  8       /* shift for CIN_INDEX field */
 
+/*
+ * Fields of the c0_entryhi register
+ */
+#define CHI_VPAGE  0xfffff000   /* virtual page number */
+#define CHI_PID    0x00000fc0   /* 6-bit address space ID */
+
+#define CHI_PIDSHIFT    6       /* shift for CHI_PID field */
+
 /*
  * Fields of the c0_context register
  *
@@ -42,7 +42,6 @@
 
 typedef __u32 paddr_t;
 typedef __u32 vaddr_t;
-typedef __u32 cm_entry_t;
 typedef __u32 p_page_t;
 typedef __u32 v_page_t;
 
@@ -119,11 +119,13 @@ paddr_t ram_getfirstfree(void);
  * TLB shootdown bits.
  *
  * We'll take up to 16 invalidations before just flushing the whole TLB.
+ * An address space has a different ASID on each CPU, so each CPU gets
+ * its own batch tagged with the ASID that is live there.
  */
 
 struct tlbshootdown {
-	vaddr_t v_page_num;
-	pid_t pid;
+	vaddr_t ts_vaddr;	/* page to invalidate */
+	unsigned ts_asid;	/* address space ID it is tagged with */
 };
 
 #define TLBSHOOTDOWN_MAX 16
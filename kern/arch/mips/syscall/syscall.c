@@ -37,6 +37,7 @@
 #include <syscall.h>
 #include <copyinout.h>
 #include <kern/wait.h>
+#include "opt-dumbvm.h"
 
 
 /*
@@ -173,6 +174,49 @@ syscall(struct trapframe *tf)
         panic("Exit syscall should never return");
         break;
 
+#if !OPT_DUMBVM
+        /* VM Syscalls */
+        case SYS_sbrk:
+        err = sys_sbrk((intptr_t) tf->tf_a0, &retval);
+        break;
+
+        case SYS_mmap: ;
+        // fd and the 64-bit offset are passed on the stack
+        int mmap_fd;
+        off_t mmap_offset;
+        err = copyin((const_userptr_t)(tf->tf_sp + 16), &mmap_fd, sizeof(int));
+        if (!err) {
+            err = copyin((const_userptr_t)(tf->tf_sp + 24), &mmap_offset,
+                         sizeof(off_t));
+        }
+        if (!err) {
+            err = sys_mmap((userptr_t) tf->tf_a0, (size_t) tf->tf_a1,
+                           tf->tf_a2, tf->tf_a3, mmap_fd, mmap_offset, &retval);
+        }
+        break;
+
+        case SYS_munmap:
+        err = sys_munmap((userptr_t) tf->tf_a0, (size_t) tf->tf_a1);
+        break;
+
+        case SYS_madvise:
+        err = sys_madvise((userptr_t) tf->tf_a0, (size_t) tf->tf_a1,
+                          tf->tf_a2);
+        break;
+
+        case SYS_vmstat:
+        err = sys_vmstat((userptr_t) tf->tf_a0);
+        break;
+
+        case SYS_getrlimit:
+        err = sys_getrlimit(tf->tf_a0, (userptr_t) tf->tf_a1);
+        break;
+
+        case SYS_setrlimit:
+        err = sys_setrlimit(tf->tf_a0, (const_userptr_t) tf->tf_a1);
+        break;
+#endif
+
 	    default:
 		kprintf("Unknown syscall %d\n", callno);
 		err = ENOSYS;
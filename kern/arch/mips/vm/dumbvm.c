@@ -116,6 +116,48 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+/*
+ * dumbvm keeps no pool of zeroed pages.
+ */
+bool
+vm_idle_zero(void)
+{
+	return false;
+}
+
+/*
+ * There is no mmap with dumbvm, so the page cache never gets pages.
+ */
+paddr_t
+coremap_alloc_shared(void)
+{
+	panic("dumbvm tried to cache a file page?!\n");
+}
+
+void
+coremap_setcache(paddr_t paddr, struct pagecache *pc, off_t offset)
+{
+	(void)paddr;
+	(void)pc;
+	(void)offset;
+	panic("dumbvm tried to cache a file page?!\n");
+}
+
+void
+coremap_incref(paddr_t paddr)
+{
+	(void)paddr;
+	panic("dumbvm tried to share a page?!\n");
+}
+
+void
+coremap_release(paddr_t paddr, struct addrspace *as)
+{
+	(void)paddr;
+	(void)as;
+	panic("dumbvm tried to release a user page?!\n");
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
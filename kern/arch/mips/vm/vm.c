@@ -1,138 +1,1357 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/vmstat.h>
 #include <lib.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <thread.h>
 #include <proc.h>
 #include <current.h>
 #include <mips/tlb.h>
 #include <addrspace.h>
+#include <vnode.h>
+#include <pagetable.h>
 #include <vm.h>
+#include <cpu.h>
+#include <swap.h>
+#include <pagecache.h>
+#include <platform/maxcpus.h>
 
 struct coremap *cm;
-p_page_t first_page; // first physical page that can be allocated
-p_page_t last_page; // last free physical page in RAM exclusive
 
-// checks if a physical page has the used bit high
-static bool p_page_used(p_page_t p_page)
+/*
+ * TLB address space IDs.
+ *
+ * Each CPU hands out ASIDs 1..NUM_ASID-1 in order. An address space
+ * remembers, for every CPU, the ASID it got there and that CPU's
+ * generation at the time, so a process that moves between CPUs finds
+ * its entries still in place when it comes back. A CPU that runs out
+ * flushes its TLB and starts a new generation, which makes every ASID
+ * it handed out before stale; until then no ASID is handed out twice,
+ * so leftover entries can never be matched by the wrong address space.
+ *
+ * as_cpumask has a bit for each CPU that has given the address space
+ * an ASID since it was last invalidated, i.e. each CPU that may hold
+ * its translations. Only the address space's own thread changes it.
+ */
+static unsigned asid_generation[MAXCPUS];
+static unsigned asid_next[MAXCPUS];
+
+/*
+ * VM statistics, one set of counters per CPU. Each set is aligned to a
+ * cache line of its own so CPUs counting faults never contend for one.
+ */
+#define VM_CACHELINE        64
+
+static struct vm_cpustats {
+    unsigned vcs_count[VMS_NCOUNTERS];
+} __attribute__((__aligned__(VM_CACHELINE))) vm_cpustats[MAXCPUS];
+
+/*
+ * Idle cpus keep up to VM_ZEROPOOL free pages cleared, VM_ZEROBATCH at
+ * a time (see vm_idle_zero), once vm_start_threads sets vm_zeroing.
+ */
+#define VM_ZEROPOOL         64
+#define VM_ZEROBATCH        4
+
+static volatile bool vm_zeroing;
+
+/*
+ * The page-out daemon is woken when fewer than vm_lowater pages are
+ * free and pages out until vm_hiwater are, so faults rarely have to
+ * page anything out themselves. Both are set from the size of RAM in
+ * vm_bootstrap and can be changed with vm_set_watermarks.
+ */
+#define VM_LOWATER_DIV      32      /* default: 1/32 of RAM */
+#define VM_HIWATER_DIV      16      /* default: 1/16 of RAM */
+
+static struct wchan *vm_pageout_wchan;
+static unsigned vm_lowater;
+static unsigned vm_hiwater;
+
+// the shared page read faults on untouched anonymous memory map
+static paddr_t vm_zeropage;
+
+// pages on either free list; caller holds cm_spinlock
+static unsigned cm_nfree(void)
+{
+    return cm->cm_last - cm->cm_counter;
+}
+
+// wakes the page-out daemon if memory is running low; caller holds cm_spinlock
+static void cm_pageout_wake(void)
+{
+    if (vm_pageout_wchan != NULL && cm_nfree() < vm_lowater) {
+        wchan_wakeone(vm_pageout_wchan, &cm->cm_spinlock);
+    }
+}
+
+// unlinks a free page from whichever free list it is on; caller holds cm_spinlock
+static void cm_freelist_remove(p_page_t p_page)
 {
-    cm_entry_t entry = cm->cm_entries[p_page];
-    bool used = entry & PP_USED;
-    return used;
+    struct cm_entry *entry = &cm->cm_entries[p_page];
+    p_page_t *head = entry->cme_zeroed ? &cm->cm_zerolist : &cm->cm_freelist;
+
+    KASSERT(entry->cme_state == CM_FREE);
+    if (entry->cme_zeroed) {
+        cm->cm_nzeroed--;
+        entry->cme_zeroed = false;
+    }
+    if (entry->cme_prev == CM_NOPAGE) {
+        KASSERT(*head == p_page);
+        *head = entry->cme_next;
+    } else {
+        cm->cm_entries[entry->cme_prev].cme_next = entry->cme_next;
+    }
+    if (entry->cme_next != CM_NOPAGE) {
+        cm->cm_entries[entry->cme_next].cme_prev = entry->cme_prev;
+    }
+    entry->cme_prev = entry->cme_next = CM_NOPAGE;
+}
+
+// pushes a page on the front of a free list; caller holds cm_spinlock
+static void cm_list_push(p_page_t p_page, bool zeroed)
+{
+    struct cm_entry *entry = &cm->cm_entries[p_page];
+    p_page_t *head = zeroed ? &cm->cm_zerolist : &cm->cm_freelist;
+
+    entry->cme_state = CM_FREE;
+    entry->cme_as = NULL;
+    entry->cme_vaddr = 0;
+    entry->cme_npages = 0;
+    entry->cme_refcount = 0;
+    entry->cme_swapslot = CM_NOSLOT;
+    entry->cme_cache = NULL;
+    entry->cme_offset = 0;
+    entry->cme_orphan = false;
+    entry->cme_busy = false;
+    entry->cme_referenced = false;
+    entry->cme_zeroed = zeroed;
+    entry->cme_prev = CM_NOPAGE;
+    entry->cme_next = *head;
+    if (*head != CM_NOPAGE) {
+        cm->cm_entries[*head].cme_prev = p_page;
+    }
+    *head = p_page;
+    if (zeroed) {
+        cm->cm_nzeroed++;
+    }
+}
+
+// frees a page whose contents are garbage; caller holds cm_spinlock
+static void cm_freelist_push(p_page_t p_page)
+{
+    cm_list_push(p_page, false);
+}
+
+// marks a page just taken off a free list as allocated; caller holds cm_spinlock
+static void cm_take(p_page_t p_page, cm_state_t state,
+                    struct addrspace *as, vaddr_t vaddr)
+{
+    struct cm_entry *entry = &cm->cm_entries[p_page];
+
+    cm_freelist_remove(p_page);
+    entry->cme_as = as;
+    entry->cme_vaddr = (state == CM_FIXED) ?
+        PADDR_TO_KVADDR(PAGE_TO_ADDR(p_page)) : vaddr;
+    entry->cme_state = state;
+    entry->cme_npages = 0;
+    entry->cme_refcount = 1;
+    entry->cme_referenced = true;
+    cm->cm_counter++;
+}
+
+// finds the first run of npages free pages, or CM_NOPAGE
+static p_page_t cm_find_run(unsigned npages)
+{
+    p_page_t start = cm->cm_first;
+    unsigned len = 0;
+
+    for (p_page_t p_page = cm->cm_first; p_page < cm->cm_last; p_page++) {
+        if (cm->cm_entries[p_page].cme_state != CM_FREE) {
+            len = 0;
+            start = p_page + 1;
+            continue;
+        }
+        if (++len == npages) {
+            return start;
+        }
+    }
+    return CM_NOPAGE;
 }
 
 void vm_bootstrap(void)
 {
-    // initialize physical ram memory
-    paddr_t cm_paddr = ram_stealmem(COREMAP_PAGES);
+    p_page_t npages = ADDR_TO_PAGE(ram_getsize());
+    size_t cm_bytes = sizeof(struct coremap) + npages * sizeof(struct cm_entry);
+    paddr_t cm_paddr;
+
+    // steal enough memory to describe every page of RAM
+    cm_paddr = ram_stealmem((cm_bytes + PAGE_SIZE - 1) / PAGE_SIZE);
     KASSERT(cm_paddr != 0);
 
     cm = (struct coremap *) PADDR_TO_KVADDR(cm_paddr);
+    cm->cm_entries = (struct cm_entry *) (cm + 1);
     spinlock_init(&cm->cm_spinlock);
+    cm->cm_freelist = CM_NOPAGE;
+    cm->cm_zerolist = CM_NOPAGE;
+    cm->cm_nzeroed = 0;
     cm->cm_counter = 0;
 
-    // check that memory is aligned
-    KASSERT(ram_stealmem(0) % PAGE_SIZE == 0);
-    first_page = ADDR_TO_PAGE(ram_stealmem(0));
-    last_page = ADDR_TO_PAGE(ram_getsize());
+    // no more stealing after this; everything below is the kernel
+    paddr_t firstfree = ram_getfirstfree();
+    KASSERT(firstfree % PAGE_SIZE == 0);
+    cm->cm_first = ADDR_TO_PAGE(firstfree);
+    cm->cm_last = npages;
 
-    // allocate physical page entries in the coremap
-    size_t pages_used = first_page;
-    for(p_page_t p_page = 0; p_page < pages_used; p_page++) {
-        v_page_t v_page = PPAGE_TO_KVPAGE(p_page);
-        cm->cm_entries[p_page] = 0 | PP_USED | v_page;
+    for (p_page_t p_page = 0; p_page < cm->cm_first; p_page++) {
+        struct cm_entry *entry = &cm->cm_entries[p_page];
+        entry->cme_as = NULL;
+        entry->cme_vaddr = PADDR_TO_KVADDR(PAGE_TO_ADDR(p_page));
+        entry->cme_state = CM_FIXED;
+        entry->cme_npages = 0;
+        entry->cme_refcount = 1;
+        entry->cme_swapslot = CM_NOSLOT;
+        entry->cme_cache = NULL;
+        entry->cme_offset = 0;
+        entry->cme_orphan = false;
+        entry->cme_busy = false;
+        entry->cme_referenced = false;
+        entry->cme_zeroed = false;
+        entry->cme_prev = entry->cme_next = CM_NOPAGE;
         cm->cm_counter++;
     }
+    cm->cm_clockhand = cm->cm_first;
+
+    // push in reverse so low pages are handed out first
+    for (p_page_t p_page = cm->cm_last; p_page > cm->cm_first; p_page--) {
+        cm_freelist_push(p_page - 1);
+    }
+
+    // generation 0 marks an address space that has no ASID yet
+    for (unsigned i = 0; i < MAXCPUS; i++) {
+        asid_generation[i] = 1;
+        asid_next[i] = 1;
+    }
+
+    vm_lowater = (cm->cm_last - cm->cm_first) / VM_LOWATER_DIV;
+    vm_hiwater = (cm->cm_last - cm->cm_first) / VM_HIWATER_DIV;
+
+    // owned by nobody and never freed, so it is never paged out or claimed
+    vm_zeropage = coremap_alloc_shared();
+    KASSERT(vm_zeropage != 0);
+    bzero((void *) PADDR_TO_KVADDR(vm_zeropage), PAGE_SIZE);
+}
+
+void vmstat_add(unsigned which, unsigned n)
+{
+    int spl;
+
+    KASSERT(which < VMS_NCOUNTERS);
+
+    // keep the thread on this CPU until it's done
+    spl = splhigh();
+    vm_cpustats[curcpu->c_number].vcs_count[which] += n;
+    splx(spl);
 }
 
-vaddr_t alloc_kpages(size_t npages)
+void vmstat_inc(unsigned which)
 {
+    vmstat_add(which, 1);
+}
+
+void vmstat_get(struct vmstat *vs)
+{
+    bzero(vs, sizeof(*vs));
+
+    // other CPUs may be counting as we read; that's fine for statistics
+    for (unsigned n = 0; n < MAXCPUS; n++) {
+        for (unsigned i = 0; i < VMS_NCOUNTERS; i++) {
+            vs->vms_count[i] += vm_cpustats[n].vcs_count[i];
+        }
+    }
+
     spinlock_acquire(&cm->cm_spinlock);
-    KASSERT(spinlock_do_i_hold(&cm->cm_spinlock));
-    // find free physical addresses by incrementing start
-    p_page_t start = first_page;
-    while (start < last_page - npages) {
-        if (!p_page_used(start)) {
-            size_t offset;
-            for (offset = 0; offset < npages; offset++) {
-                if (p_page_used(start + offset)) {
-                    break;
-                }
-            }
+    vs->vms_totalpages = cm->cm_last - cm->cm_first;
+    vs->vms_freepages = cm->cm_last - cm->cm_counter;
+    vs->vms_zeroedpages = cm->cm_nzeroed;
+    vs->vms_lowater = vm_lowater;
+    vs->vms_hiwater = vm_hiwater;
+    spinlock_release(&cm->cm_spinlock);
+
+    swap_usage(&vs->vms_swapslots, &vs->vms_swapused);
+}
+
+/*
+ * Top up the pool of zeroed free pages by up to VM_ZEROBATCH pages.
+ * Called by thread_switch on a cpu with nothing to run, so the work
+ * only ever uses otherwise idle time; it must not sleep. Returns true
+ * if it cleared anything.
+ */
+bool vm_idle_zero(void)
+{
+    p_page_t p_page;
+    unsigned i;
+
+    if (!vm_zeroing) {
+        return false;
+    }
+
+    for (i = 0; i < VM_ZEROBATCH; i++) {
+        spinlock_acquire(&cm->cm_spinlock);
+        if (cm->cm_nzeroed >= VM_ZEROPOOL || cm->cm_freelist == CM_NOPAGE) {
+            spinlock_release(&cm->cm_spinlock);
+            break;
+        }
+        // hold it as a kernel page while clearing it
+        p_page = cm->cm_freelist;
+        cm_take(p_page, CM_FIXED, NULL, 0);
+        spinlock_release(&cm->cm_spinlock);
+
+        bzero((void *) PADDR_TO_KVADDR(PAGE_TO_ADDR(p_page)), PAGE_SIZE);
+
+        spinlock_acquire(&cm->cm_spinlock);
+        cm_list_push(p_page, true);
+        cm->cm_counter--;
+        spinlock_release(&cm->cm_spinlock);
+    }
+    return i > 0;
+}
 
-            if (offset == npages) {
+static bool vm_pageout(void);
+
+/*
+ * Page out until vm_hiwater pages are free whenever fewer than
+ * vm_lowater are. If nothing more can go, wait for the next
+ * allocation that finds memory low rather than spinning.
+ */
+static void vm_pageout_thread(void *data1, unsigned long data2)
+{
+    bool stuck = false;
+    unsigned tries;
+
+    (void) data1;
+    (void) data2;
+
+    for (;;) {
+        spinlock_acquire(&cm->cm_spinlock);
+        while (stuck || cm_nfree() >= vm_lowater) {
+            wchan_sleep(vm_pageout_wchan, &cm->cm_spinlock);
+            stuck = false;
+        }
+
+        // a busy owner makes vm_pageout skip a page, so bound the sweep
+        tries = 2 * (cm->cm_last - cm->cm_first);
+        while (cm_nfree() < vm_hiwater && tries-- > 0) {
+            spinlock_release(&cm->cm_spinlock);
+            if (!vm_pageout()) {
+                stuck = true;
+            }
+            thread_yield();
+            spinlock_acquire(&cm->cm_spinlock);
+            if (stuck) {
                 break;
             }
         }
+        if (cm_nfree() < vm_hiwater) {
+            stuck = true;
+        }
+        spinlock_release(&cm->cm_spinlock);
+    }
+}
+
+void vm_start_threads(void)
+{
+    int result;
+
+    vm_pageout_wchan = wchan_create("vmpageout");
+    if (vm_pageout_wchan == NULL) {
+        panic("vm: could not create wchans\n");
+    }
+
+    // idle cpus can start clearing pages now
+    vm_zeroing = true;
+
+    result = thread_fork("vmpageout", NULL, vm_pageout_thread, NULL, 0);
+    if (result) {
+        panic("vm: could not start page-out daemon: %s\n", strerror(result));
+    }
+}
+
+int vm_set_watermarks(unsigned lowater, unsigned hiwater)
+{
+    if (lowater > hiwater || hiwater > cm->cm_last - cm->cm_first) {
+        return EINVAL;
+    }
+
+    spinlock_acquire(&cm->cm_spinlock);
+    vm_lowater = lowater;
+    vm_hiwater = hiwater;
+    cm_pageout_wake();
+    spinlock_release(&cm->cm_spinlock);
+
+    return 0;
+}
 
-        (start)++;
+// takes npages free pages off the free list, or returns 0
+static paddr_t cm_alloc(unsigned npages, cm_state_t state,
+                        struct addrspace *as, vaddr_t vaddr)
+{
+    p_page_t start;
+
+    KASSERT(npages > 0);
+
+    spinlock_acquire(&cm->cm_spinlock);
+
+    // zeroed pages are only handed out here once the others are gone
+    if (npages == 1) {
+        start = cm->cm_freelist;
+        if (start == CM_NOPAGE) {
+            start = cm->cm_zerolist;
+        }
+    } else {
+        start = cm_find_run(npages);
     }
-    
-    // check that there are physical addresses to allocate
-    if (start == last_page - npages) {
+
+    // check that there are physical pages to allocate
+    if (start == CM_NOPAGE) {
         spinlock_release(&cm->cm_spinlock);
-        return 0;   
+        return 0;
     }
 
-    // allocate npages of physical address starting from start
     for (p_page_t p_page = start; p_page < start + npages; p_page++) {
-        v_page_t v_page = PPAGE_TO_KVPAGE(p_page);
-        cm->cm_entries[p_page] = 0 | PP_USED | v_page;
-        cm->cm_counter++;
+        cm_take(p_page, state, as, vaddr + PAGE_TO_ADDR(p_page - start));
     }
+    cm->cm_entries[start].cme_npages = npages;
+    cm_pageout_wake();
 
-    // flag the last page in the coremap as the end of kmalloc 
-    cm->cm_entries[start + npages - 1] = cm->cm_entries[start + npages - 1] | KMALLOC_END;
     spinlock_release(&cm->cm_spinlock);
 
-    return PADDR_TO_KVADDR(PAGE_TO_ADDR(start));
+    return PAGE_TO_ADDR(start);
 }
 
-void free_kpages(vaddr_t addr)
+// paging out sleeps, so only do it from a thread holding no spinlocks
+static bool vm_can_page(void)
+{
+    return curthread != NULL && !curthread->t_in_interrupt &&
+        curthread->t_iplhigh_count == 0;
+}
+
+// cm_alloc, paging out to make room if need be
+static paddr_t cm_alloc_paging(unsigned npages, cm_state_t state,
+                               struct addrspace *as, vaddr_t vaddr)
 {
-    p_page_t curr = ADDR_TO_PAGE(KVADDR_TO_PADDR(addr));
+    paddr_t paddr;
+
+    KASSERT(npages > 0);
+
+    paddr = cm_alloc(npages, state, as, vaddr);
+    if (paddr != 0 || !vm_can_page()) {
+        return paddr;
+    }
+
+    /*
+     * Memory ran out before the daemon could keep up. Each page-out
+     * frees a page, so this many always finds a run if one can exist.
+     */
+    for (p_page_t i = cm->cm_first; paddr == 0 && i < cm->cm_last; i++) {
+        if (!vm_pageout()) {
+            break;
+        }
+        vmstat_inc(VMS_RECLAIM);
+        paddr = cm_alloc(npages, state, as, vaddr);
+    }
+
+    return paddr;
+}
+
+paddr_t coremap_alloc(unsigned npages, struct addrspace *as, vaddr_t vaddr)
+{
+    return cm_alloc_paging(npages, (as == NULL) ? CM_FIXED : CM_USER,
+                           as, vaddr);
+}
+
+// a zeroed user page, paging out to find one only if PAGING is set
+static paddr_t cm_alloc_zeroed(struct addrspace *as, vaddr_t vaddr, bool paging)
+{
+    p_page_t p_page;
+    paddr_t paddr;
 
     spinlock_acquire(&cm->cm_spinlock);
-    
-    // frees pages until it finds an entry with the kmalloc_end flag
-    while (p_page_used(curr)) {
-        bool end = cm->cm_entries[curr] & KMALLOC_END;
-
-        // free the page
-        KASSERT(first_page <= curr && curr < last_page);
-        cm->cm_entries[curr] = 0;
+    p_page = cm->cm_zerolist;
+    if (p_page != CM_NOPAGE) {
+        cm_take(p_page, CM_USER, as, vaddr);
+        cm->cm_entries[p_page].cme_npages = 1;
+        cm_pageout_wake();
+        spinlock_release(&cm->cm_spinlock);
+        return PAGE_TO_ADDR(p_page);
+    }
+    spinlock_release(&cm->cm_spinlock);
+
+    // the pool ran dry; clear one ourselves
+    paddr = paging ? coremap_alloc(1, as, vaddr) : cm_alloc(1, CM_USER, as, vaddr);
+    if (paddr != 0) {
+        bzero((void *) PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+    }
+    return paddr;
+}
+
+paddr_t coremap_alloc_zeroed(struct addrspace *as, vaddr_t vaddr)
+{
+    return cm_alloc_zeroed(as, vaddr, true);
+}
+
+paddr_t coremap_alloc_shared(void)
+{
+    return cm_alloc_paging(1, CM_USER, NULL, 0);
+}
+
+void coremap_free(paddr_t paddr)
+{
+    p_page_t start = ADDR_TO_PAGE(paddr);
+    unsigned npages;
+
+    spinlock_acquire(&cm->cm_spinlock);
+
+    KASSERT(cm->cm_first <= start && start < cm->cm_last);
+    npages = cm->cm_entries[start].cme_npages;
+    KASSERT(npages > 0);
+    KASSERT(start + npages <= cm->cm_last);
+
+    // still mapped copy-on-write by someone else
+    KASSERT(cm->cm_entries[start].cme_refcount > 0);
+    if (--cm->cm_entries[start].cme_refcount > 0) {
+        spinlock_release(&cm->cm_spinlock);
+        return;
+    }
+
+    for (p_page_t p_page = start; p_page < start + npages; p_page++) {
+        KASSERT(cm->cm_entries[p_page].cme_state != CM_FREE);
+        cm_freelist_push(p_page);
         cm->cm_counter--;
+    }
 
-        if (end) {
-            spinlock_release(&cm->cm_spinlock);
-            return;
-        }
-        curr++;
+    spinlock_release(&cm->cm_spinlock);
+}
+
+void coremap_release(paddr_t paddr, struct addrspace *as)
+{
+    p_page_t p_page = ADDR_TO_PAGE(paddr);
+    struct cm_entry *entry = &cm->cm_entries[p_page];
+    unsigned slot = CM_NOSLOT;
+
+    spinlock_acquire(&cm->cm_spinlock);
+    KASSERT(entry->cme_state == CM_USER);
+
+    /*
+     * The page-out code only keeps a page busy for long once it holds
+     * the owner's lock, which our caller has, so this is a short wait.
+     */
+    while (entry->cme_busy) {
+        spinlock_release(&cm->cm_spinlock);
+        thread_yield();
+        spinlock_acquire(&cm->cm_spinlock);
+    }
+
+    KASSERT(entry->cme_refcount > 0);
+    if (entry->cme_as == as) {
+        // whoever still shares it maps it at the same address
+        entry->cme_as = NULL;
+        entry->cme_orphan = entry->cme_cache == NULL;
+    }
+    if (--entry->cme_refcount == 0) {
+        slot = entry->cme_swapslot;
+        cm_freelist_push(p_page);
+        cm->cm_counter--;
     }
 
     spinlock_release(&cm->cm_spinlock);
+
+    if (slot != CM_NOSLOT) {
+        swap_free(slot);
+    }
 }
 
-void
-vm_tlbshootdown_all()
+void coremap_incref(paddr_t paddr)
+{
+    p_page_t p_page = ADDR_TO_PAGE(paddr);
+
+    spinlock_acquire(&cm->cm_spinlock);
+    KASSERT(cm->cm_entries[p_page].cme_state == CM_USER);
+    KASSERT(cm->cm_entries[p_page].cme_npages == 1);
+    cm->cm_entries[p_page].cme_refcount++;
+    spinlock_release(&cm->cm_spinlock);
+}
+
+void coremap_setcache(paddr_t paddr, struct pagecache *pc, off_t offset)
+{
+    struct cm_entry *entry = &cm->cm_entries[ADDR_TO_PAGE(paddr)];
+
+    spinlock_acquire(&cm->cm_spinlock);
+    KASSERT(entry->cme_state == CM_USER);
+    KASSERT(entry->cme_npages == 1);
+    entry->cme_cache = pc;
+    entry->cme_offset = offset;
+    spinlock_release(&cm->cm_spinlock);
+}
+
+// records AS as the mapper of a page cache page if it is the only one
+static void cm_note_mapper(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+    struct cm_entry *entry = &cm->cm_entries[ADDR_TO_PAGE(paddr)];
+
+    spinlock_acquire(&cm->cm_spinlock);
+    if (entry->cme_cache != NULL && entry->cme_refcount == 2 &&
+        entry->cme_as == NULL) {
+        entry->cme_as = as;
+        entry->cme_vaddr = vaddr;
+    }
+    spinlock_release(&cm->cm_spinlock);
+}
+
+bool coremap_claim(paddr_t paddr, struct addrspace *as, vaddr_t vaddr)
+{
+    p_page_t p_page = ADDR_TO_PAGE(paddr);
+    struct cm_entry *entry = &cm->cm_entries[p_page];
+    bool sole;
+
+    spinlock_acquire(&cm->cm_spinlock);
+    KASSERT(entry->cme_state == CM_USER);
+    sole = entry->cme_refcount == 1;
+    if (sole) {
+        entry->cme_as = as;
+        entry->cme_vaddr = vaddr;
+        entry->cme_orphan = false;
+    }
+    spinlock_release(&cm->cm_spinlock);
+
+    return sole;
+}
+
+vaddr_t alloc_kpages(unsigned npages)
+{
+    paddr_t paddr = coremap_alloc(npages, NULL, 0);
+    if (paddr == 0) {
+        return 0;
+    }
+    return PADDR_TO_KVADDR(paddr);
+}
+
+void free_kpages(vaddr_t addr)
+{
+    coremap_free(KVADDR_TO_PADDR(addr));
+}
+
+// sets the swap slot of a user page and returns the one it had
+static unsigned cm_set_swapslot(paddr_t paddr, unsigned slot)
+{
+    struct cm_entry *entry = &cm->cm_entries[ADDR_TO_PAGE(paddr)];
+    unsigned oldslot;
+
+    spinlock_acquire(&cm->cm_spinlock);
+    KASSERT(entry->cme_state == CM_USER);
+    oldslot = entry->cme_swapslot;
+    entry->cme_swapslot = slot;
+    spinlock_release(&cm->cm_spinlock);
+
+    return oldslot;
+}
+
+// gives a page its second chance the next time the clock comes round
+static void cm_mark_referenced(paddr_t paddr)
+{
+    spinlock_acquire(&cm->cm_spinlock);
+    cm->cm_entries[ADDR_TO_PAGE(paddr)].cme_referenced = true;
+    spinlock_release(&cm->cm_spinlock);
+}
+
+// marks all tlb entries as invalid; caller has interrupts off
+static void vm_tlb_flush(void)
 {
-    // marks all tlb entries as invalid
     for (int i = 0; i < NUM_TLB; i++){
         tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
     }
 }
 
+void
+vm_tlbshootdown_all()
+{
+    vm_tlb_flush();
+}
+
 
 void
 vm_tlbshootdown(const struct tlbshootdown *tlbsd)
 {
-    // marks specific tlb entries as invalid up to index
-    vaddr_t v_page = tlbsd->v_page_num;
-    pid_t pid = tlbsd->pid;
-    uint32_t entryhi = 0 | (v_page & PAGE_FRAME) | pid << 6;
+    // marks the entry for one page of one address space as invalid
+    uint32_t entryhi = (tlbsd->ts_vaddr & PAGE_FRAME) |
+        (tlbsd->ts_asid << TLBHI_PIDSHIFT);
     int32_t index = tlb_probe(entryhi, 0);
 
     if (index > -1) {
         tlb_write(TLBHI_INVALID(index), TLBLO_INVALID(), index);
     }
 }
+
+/*
+ * Only CPUs in AS's mask whose ASID for AS is still current can hold
+ * live entries, so only they are sent a shootdown: one batch each,
+ * tagged with AS's ASID there. Entries on this CPU are removed
+ * directly. Waits for the others to finish, since the caller is about
+ * to reuse or free the pages.
+ */
+void vm_tlb_unmap(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+    struct tlbshootdown ts[TLBSHOOTDOWN_MAX];
+    unsigned npages;
+    uint32_t mask, sent = 0;
+    struct cpu *target;
+    unsigned self;
+    bool done;
+    int spl;
+
+    KASSERT(start % PAGE_SIZE == 0 && end % PAGE_SIZE == 0);
+    KASSERT(start <= end);
+    KASSERT(lock_do_i_hold(as->as_lock));
+    npages = (end - start) / PAGE_SIZE;
+
+    if (npages > TLBSHOOTDOWN_MAX) {
+        // the targets would flush everything anyway; fresh ASIDs are cheaper
+        KASSERT(as == proc_getas());
+        vm_tlb_invalidate(as);
+        return;
+    }
+
+    // stay on this CPU while deciding what is local
+    spl = splhigh();
+    self = curcpu->c_number;
+    mask = as->as_cpumask;
+    for (unsigned n = 0; n < MAXCPUS; n++) {
+        if (!(mask & ((uint32_t)1 << n)) ||
+            as->as_asidgen[n] != asid_generation[n]) {
+            // never ran there, or that CPU has flushed since
+            continue;
+        }
+
+        for (unsigned i = 0; i < npages; i++) {
+            ts[i].ts_vaddr = start + i * PAGE_SIZE;
+            ts[i].ts_asid = as->as_asid[n];
+        }
+        if (n == self) {
+            for (unsigned i = 0; i < npages; i++) {
+                vm_tlbshootdown(&ts[i]);
+            }
+        } else if (npages > 0) {
+            ipi_tlbshootdown_batch(cpu_bynumber(n), ts, npages);
+            sent |= (uint32_t)1 << n;
+            vmstat_inc(VMS_SHOOTDOWN);
+        }
+    }
+    splx(spl);
+
+    for (unsigned n = 0; sent != 0; n++) {
+        if (!(sent & ((uint32_t)1 << n))) {
+            continue;
+        }
+        sent &= ~((uint32_t)1 << n);
+
+        target = cpu_bynumber(n);
+        do {
+            spinlock_acquire(&target->c_ipi_lock);
+            done = target->c_numshootdown == 0;
+            spinlock_release(&target->c_ipi_lock);
+        } while (!done);
+    }
+}
+
+void vm_tlb_activate(struct addrspace *as)
+{
+    unsigned n;
+    int spl;
+
+    /* Disable interrupts on this CPU while frobbing the TLB. */
+    spl = splhigh();
+
+    n = curcpu->c_number;
+    if (as->as_asidgen[n] != asid_generation[n]) {
+        if (asid_next[n] == NUM_ASID) {
+            vm_tlb_flush();
+            asid_generation[n]++;
+            asid_next[n] = 1;
+        }
+        as->as_asid[n] = asid_next[n]++;
+        as->as_asidgen[n] = asid_generation[n];
+    }
+    as->as_cpumask |= (uint32_t)1 << n;
+    tlb_setasid(as->as_asid[n]);
+
+    splx(spl);
+}
+
+void vm_tlb_invalidate(struct addrspace *as)
+{
+    // old ASIDs are never reused before a flush, so just drop them all
+    for (unsigned n = 0; n < MAXCPUS; n++) {
+        as->as_asidgen[n] = 0;
+    }
+    as->as_cpumask = 0;
+    if (as == proc_getas()) {
+        vm_tlb_activate(as);
+    }
+}
+
+/*
+ * Load a translation into the TLB, replacing any existing entry for
+ * the same page (e.g. after a copy-on-write break). If every slot is
+ * in use, the hardware's random register picks the victim; that
+ * avoids keeping reference state for 64 entries and does as well as
+ * anything cleverer on the workloads we run.
+ */
+static void vm_tlb_load(struct addrspace *as, uint32_t ehi, uint32_t elo)
+{
+    uint32_t oldehi, oldelo;
+    int index;
+    int spl;
+
+    /* Disable interrupts on this CPU while frobbing the TLB. */
+    spl = splhigh();
+
+    KASSERT(as->as_asidgen[curcpu->c_number] ==
+            asid_generation[curcpu->c_number]);
+    ehi |= as->as_asid[curcpu->c_number] << TLBHI_PIDSHIFT;
+
+    index = tlb_probe(ehi, 0);
+    if (index >= 0) {
+        tlb_write(ehi, elo, index);
+        splx(spl);
+        return;
+    }
+
+    for (int i = 0; i < NUM_TLB; i++) {
+        tlb_read(&oldehi, &oldelo, i);
+        if (oldelo & TLBLO_VALID) {
+            continue;
+        }
+        tlb_write(ehi, elo, i);
+        splx(spl);
+        return;
+    }
+
+    as->as_tlbevictions++;
+    tlb_random(ehi, elo);
+    splx(spl);
+}
+
+/*
+ * Take the user page P_PAGE, mapped by AS at VADDR, out of memory. A
+ * dirty page is written to a new swap slot; a clean one keeps the slot
+ * it was read from, or if it never left memory is simply forgotten and
+ * filled again from zero or the file on the next fault. The caller
+ * holds AS's lock and has marked the page busy.
+ */
+static int vm_evict(struct addrspace *as, vaddr_t vaddr, p_page_t p_page)
+{
+    struct cm_entry *entry = &cm->cm_entries[p_page];
+    paddr_t paddr = PAGE_TO_ADDR(p_page);
+    unsigned slot;
+    pte_t *pte;
+    pte_t old;
+    int result;
+
+    pte = pt_lookup(as->as_pt, vaddr, false);
+    if (pte == NULL || (*pte & (PTE_FRAME | PTE_VALID)) != (paddr | PTE_VALID)) {
+        // vm_fault has allocated it but not mapped it yet
+        return EAGAIN;
+    }
+
+    // nobody may see the page again before it is on disk
+    old = *pte;
+    *pte &= ~PTE_VALID;
+    vm_tlb_unmap(as, vaddr, vaddr + PAGE_SIZE);
+
+    slot = entry->cme_swapslot;
+    if (old & PTE_DIRTY) {
+        KASSERT(slot == CM_NOSLOT);
+        result = swap_alloc(&slot);
+        if (result == 0) {
+            result = swap_out(paddr, slot);
+            if (result) {
+                swap_free(slot);
+            }
+        }
+        if (result) {
+            *pte = old;
+            return result;
+        }
+    }
+
+    // the slot now belongs to the page table entry
+    *pte = (slot == CM_NOSLOT) ? 0 : PTE_MKSWAP(slot);
+    entry->cme_swapslot = CM_NOSLOT;
+    vmstat_inc(VMS_EVICT);
+
+    return 0;
+}
+
+// true if the clock may take the page; caller holds cm_spinlock
+static bool cm_pageable(struct cm_entry *entry)
+{
+    if (entry->cme_state != CM_USER || entry->cme_busy) {
+        return false;
+    }
+    if (entry->cme_cache != NULL) {
+        // only in the cache, or in it and mapped by cme_as alone
+        return entry->cme_refcount == 1 ||
+            (entry->cme_refcount == 2 && entry->cme_as != NULL);
+    }
+    return entry->cme_refcount == 1 &&
+        (entry->cme_as != NULL || entry->cme_orphan);
+}
+
+/*
+ * Free one user page, chosen by the clock algorithm. Returns false if
+ * nothing more can be paged out, either because no page qualifies or
+ * because swap is full.
+ *
+ * A page cache page is first dropped from its cache, which hands its
+ * reference to us; if the cache is busy, we try another page next
+ * time. If it is still mapped, it is then evicted from its mapper as
+ * any other page. Should that fail, it stays with the mapper as an
+ * ordinary page.
+ *
+ * An orphan, a page left by its recorded owner to the one address
+ * space still sharing it since fork, is evicted from whichever address
+ * space maps it at cme_vaddr.
+ */
+static bool vm_pageout(void)
+{
+    struct cm_entry *entry = NULL;
+    struct addrspace *as;
+    struct pagecache *pc;
+    off_t offset;
+    vaddr_t vaddr;
+    p_page_t victim = CM_NOPAGE;
+    unsigned drop = 0;
+    bool locked;
+    int result = 0;
+
+    spinlock_acquire(&cm->cm_spinlock);
+
+    // two sweeps, since the first may only clear reference bits
+    for (p_page_t n = 0; n < 2 * (cm->cm_last - cm->cm_first); n++) {
+        p_page_t p_page = cm->cm_clockhand;
+
+        if (++cm->cm_clockhand == cm->cm_last) {
+            cm->cm_clockhand = cm->cm_first;
+        }
+
+        entry = &cm->cm_entries[p_page];
+        if (!cm_pageable(entry)) {
+            continue;
+        }
+        if (entry->cme_referenced) {
+            entry->cme_referenced = false;
+            continue;
+        }
+        victim = p_page;
+        break;
+    }
+
+    if (victim == CM_NOPAGE) {
+        spinlock_release(&cm->cm_spinlock);
+        return false;
+    }
+
+    // busy keeps the page, and so its address space or cache, from going away
+    entry->cme_busy = true;
+    as = entry->cme_as;
+    vaddr = entry->cme_vaddr;
+    pc = entry->cme_cache;
+    offset = entry->cme_offset;
+    spinlock_release(&cm->cm_spinlock);
+
+    if (as == NULL && pc == NULL) {
+        // the page is busy, so its mapper can't drop it and go away
+        as = as_find_mapper(vaddr, PAGE_TO_ADDR(victim));
+        if (as == NULL) {
+            result = EAGAIN;
+        }
+    } else if (pc != NULL) {
+        if (pagecache_reclaim(pc, offset, PAGE_TO_ADDR(victim))) {
+            drop++;
+        } else {
+            result = EAGAIN;
+        }
+    }
+
+    /*
+     * Never wait for another address space's lock: its holder may be
+     * allocating memory itself. Try a different page next time.
+     */
+    if (result == 0 && as != NULL) {
+        locked = !lock_do_i_hold(as->as_lock);
+        if (locked && !lock_tryacquire(as->as_lock)) {
+            result = EAGAIN;
+        } else {
+            result = vm_evict(as, vaddr, victim);
+            if (locked) {
+                lock_release(as->as_lock);
+            }
+        }
+        if (result == 0) {
+            drop++;
+        }
+    }
+
+    spinlock_acquire(&cm->cm_spinlock);
+    entry->cme_busy = false;
+    KASSERT(entry->cme_refcount >= drop);
+    entry->cme_refcount -= drop;
+    if (entry->cme_refcount == 0) {
+        cm_freelist_push(victim);
+        cm->cm_counter--;
+    }
+    spinlock_release(&cm->cm_spinlock);
+
+    return result != ENOSPC;
+}
+
+/*
+ * Give AS its own copy of the copy-on-write page at VADDR. If nobody
+ * else maps the frame any more it is simply taken over.
+ */
+static int vm_cow_break(struct addrspace *as, vaddr_t vaddr, pte_t *pte)
+{
+    paddr_t oldpaddr = *pte & PTE_FRAME;
+    paddr_t newpaddr;
+
+    if (coremap_claim(oldpaddr, as, vaddr)) {
+        *pte &= ~PTE_COW;
+        vmstat_inc(VMS_COWCLAIM);
+        return 0;
+    }
+
+    if (oldpaddr == vm_zeropage) {
+        // nothing to copy
+        newpaddr = coremap_alloc_zeroed(as, vaddr);
+        if (newpaddr == 0) {
+            return ENOMEM;
+        }
+    } else {
+        // hold an extra reference so the old page can't be paged out under us
+        coremap_incref(oldpaddr);
+        newpaddr = coremap_alloc(1, as, vaddr);
+        if (newpaddr == 0) {
+            coremap_free(oldpaddr);
+            return ENOMEM;
+        }
+        memmove((void *) PADDR_TO_KVADDR(newpaddr),
+                (const void *) PADDR_TO_KVADDR(oldpaddr), PAGE_SIZE);
+        coremap_free(oldpaddr);
+    }
+
+    // other CPUs we ran on may still map the old page read-only
+    vmstat_inc(VMS_COWCOPY);
+    *pte = newpaddr | PTE_VALID;
+    vm_tlb_unmap(as, vaddr, vaddr + PAGE_SIZE);
+    coremap_release(oldpaddr, as);
+
+    return 0;
+}
+
+/*
+ * Map up to NPAGES untouched pages following FAULTADDRESS in RG, the
+ * way vm_fault_page would on first touch, and load them into the TLB.
+ * Stops early at the end of the region, at a page that already has a
+ * page table entry, or when no free page is at hand: this is only a
+ * guess, so it never pages anything out. Pages read from the file are
+ * read with a single request. Returns how many pages were mapped.
+ */
+static unsigned vm_fault_around(struct addrspace *as, struct region *rg,
+                                int faulttype, vaddr_t faultaddress,
+                                unsigned npages)
+{
+    pte_t *ptes[VM_FAULTAROUND_MAX];
+    paddr_t paddrs[VM_FAULTAROUND_MAX];
+    vaddr_t first = faultaddress + PAGE_SIZE;
+    vaddr_t end = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+    vaddr_t vaddr;
+    unsigned n = 0;
+    int result;
+
+    KASSERT(npages <= VM_FAULTAROUND_MAX);
+
+    for (vaddr = first; n < npages && vaddr < end; vaddr += PAGE_SIZE) {
+        pte_t *pte = pt_lookup(as->as_pt, vaddr, true);
+        if (pte == NULL || *pte != 0) {
+            break;
+        }
+        ptes[n++] = pte;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    if (rg->rg_flags & RGF_PAGECACHE) {
+        for (unsigned i = 0; i < n; i++) {
+            result = VOP_MMAP(rg->rg_vnode,
+                              rg->rg_offset + (first - rg->rg_vbase) +
+                              i * PAGE_SIZE, &paddrs[i]);
+            if (result) {
+                n = i;
+                break;
+            }
+            *ptes[i] = paddrs[i] | PTE_VALID | PTE_COW;
+            cm_note_mapper(paddrs[i], as, first + i * PAGE_SIZE);
+        }
+    } else if (faulttype == VM_FAULT_READ &&
+               !region_page_has_file(rg, first)) {
+        // a read walking through fresh memory: more of the zero page
+        for (unsigned i = 0; i < n; i++) {
+            coremap_incref(vm_zeropage);
+            paddrs[i] = vm_zeropage;
+            *ptes[i] = vm_zeropage | PTE_VALID | PTE_COW;
+        }
+    } else {
+        for (unsigned i = 0; i < n; i++) {
+            paddrs[i] = cm_alloc_zeroed(as, first + i * PAGE_SIZE, false);
+            if (paddrs[i] == 0) {
+                n = i;
+                break;
+            }
+        }
+        if (n == 0) {
+            return 0;
+        }
+
+        result = region_fill_pages(rg, first, paddrs, n);
+        if (result) {
+            for (unsigned i = 0; i < n; i++) {
+                coremap_release(paddrs[i], as);
+            }
+            return 0;
+        }
+
+        // clean until written, so untouched pages are never swapped out
+        for (unsigned i = 0; i < n; i++) {
+            *ptes[i] = paddrs[i] | PTE_VALID;
+        }
+    }
+
+    // all read-only: the first write to each takes the dirty fault
+    for (unsigned i = 0; i < n; i++) {
+        vm_tlb_load(as, first + i * PAGE_SIZE, paddrs[i] | TLBLO_VALID);
+    }
+
+    as->as_prefetched += n;
+    vmstat_add(VMS_FAULTAROUND, n);
+    return n;
+}
+
+/*
+ * Work out how many pages to fault around a fault at FAULTADDRESS in
+ * RG. A fault just past the pages the last one mapped means the
+ * program is walking through the region, so the window doubles; one
+ * on a page that was mapped last time (e.g. the first write to it)
+ * changes nothing; anything else starts over.
+ */
+static unsigned vm_fault_window(struct region *rg, vaddr_t faultaddress)
+{
+    if (faultaddress == rg->rg_fanext && rg->rg_famax > 0) {
+        rg->rg_fawindow = (rg->rg_fawindow == 0) ? 1 : rg->rg_fawindow * 2;
+        if (rg->rg_fawindow > rg->rg_famax) {
+            rg->rg_fawindow = rg->rg_famax;
+        }
+    } else if (faultaddress >= rg->rg_fastart && faultaddress < rg->rg_fanext) {
+        return 0;
+    } else {
+        rg->rg_fawindow = 0;
+    }
+
+    rg->rg_fastart = faultaddress;
+    rg->rg_fanext = faultaddress + PAGE_SIZE;
+    return rg->rg_fawindow;
+}
+
+/*
+ * Make the page at VADDR resident and writable if need be, and load it
+ * into the TLB, along with any pages faulted around it. The caller
+ * holds AS's lock.
+ */
+static int vm_fault_page(struct addrspace *as, struct region *rg,
+                         int faulttype, vaddr_t faultaddress)
+{
+    pte_t *pte;
+    paddr_t paddr;
+    unsigned slot, window;
+    uint32_t elo;
+    int result;
+
+    window = vm_fault_window(rg, faultaddress);
+
+    pte = pt_lookup(as->as_pt, faultaddress, true);
+    if (pte == NULL) {
+        return ENOMEM;
+    }
+
+    if (!(*pte & (PTE_VALID | PTE_SWAPPED)) && (rg->rg_flags & RGF_PAGECACHE)) {
+        // share the file's cached page until somebody writes to it
+        result = VOP_MMAP(rg->rg_vnode,
+                          rg->rg_offset + (faultaddress - rg->rg_vbase),
+                          &paddr);
+        if (result) {
+            return result;
+        }
+        *pte = paddr | PTE_VALID | PTE_COW;
+        cm_note_mapper(paddr, as, faultaddress);
+        vmstat_inc(VMS_PAGECACHE);
+    } else if (!(*pte & (PTE_VALID | PTE_SWAPPED)) &&
+               faulttype == VM_FAULT_READ &&
+               !region_page_has_file(rg, faultaddress)) {
+        // reading memory nobody has written yet: share the zero page
+        coremap_incref(vm_zeropage);
+        *pte = vm_zeropage | PTE_VALID | PTE_COW;
+        vmstat_inc(VMS_ZEROPAGE);
+    } else if (!(*pte & PTE_VALID)) {
+        if (*pte & PTE_SWAPPED) {
+            // paged out: the copy on disk stays good until it is written
+            slot = PTE_SLOT(*pte);
+            paddr = coremap_alloc(1, as, faultaddress);
+            result = (paddr == 0) ? ENOMEM : swap_in(slot, paddr);
+        } else {
+            // first touch: a zeroed page, filled from the file if any
+            slot = CM_NOSLOT;
+            paddr = coremap_alloc_zeroed(as, faultaddress);
+            result = (paddr == 0) ? ENOMEM :
+                region_fill_page(rg, faultaddress, paddr);
+            vmstat_inc(region_page_has_file(rg, faultaddress) ?
+                       VMS_FILEFILL : VMS_ZEROFILL);
+        }
+        if (result) {
+            if (paddr != 0) {
+                coremap_release(paddr, as);
+            }
+            return result;
+        }
+
+        cm_set_swapslot(paddr, slot);
+        *pte = paddr | PTE_VALID;
+    }
+
+    if (faulttype != VM_FAULT_READ) {
+        // writing a page shared by fork
+        if (*pte & PTE_COW) {
+            result = vm_cow_break(as, faultaddress, pte);
+            if (result) {
+                return result;
+            }
+        }
+
+        // any copy in swap is about to go stale
+        if (!(*pte & PTE_DIRTY)) {
+            *pte |= PTE_DIRTY;
+            slot = cm_set_swapslot(*pte & PTE_FRAME, CM_NOSLOT);
+            if (slot != CM_NOSLOT) {
+                swap_free(slot);
+            }
+        }
+    }
+
+    paddr = *pte & PTE_FRAME;
+    cm_mark_referenced(paddr);
+
+    /*
+     * Clean pages are mapped read-only even in writable regions, so
+     * the first write comes back here as VM_FAULT_READONLY and the
+     * page can be marked dirty.
+     */
+    elo = paddr | TLBLO_VALID;
+    if ((rg->rg_perms & RG_W) && !(*pte & PTE_COW) && (*pte & PTE_DIRTY)) {
+        elo |= TLBLO_DIRTY;
+    }
+
+    DEBUG(DB_VM, "vm: 0x%x -> 0x%x\n", faultaddress, paddr);
+    vm_tlb_load(as, faultaddress, elo);
+
+    if (window > 0) {
+        rg->rg_fanext += vm_fault_around(as, rg, faulttype, faultaddress,
+                                         window) * PAGE_SIZE;
+    }
+
+    return 0;
+}
+
+/*
+ * Resolve a TLB miss through the current address space's page table.
+ * On first touch a zeroed page is allocated and, for file-backed
+ * regions, the page's part of the executable is read into it. Pages
+ * that were paged out are read back from swap. Writes to pages shared
+ * by fork get a private copy. When faults walk through a region in
+ * order, the pages ahead of the fault are mapped at the same time.
+ */
+int vm_fault(int faulttype, vaddr_t faultaddress)
+{
+    struct addrspace *as;
+    struct region *rg;
+    int result;
+
+    faultaddress &= PAGE_FRAME;
+
+    DEBUG(DB_VM, "vm: fault: 0x%x\n", faultaddress);
+
+    switch (faulttype) {
+        case VM_FAULT_READONLY:
+        case VM_FAULT_READ:
+        case VM_FAULT_WRITE:
+        break;
+        default:
+        return EINVAL;
+    }
+
+    if (curproc == NULL) {
+        /*
+         * No process. This is probably a kernel fault early
+         * in boot. Return EFAULT so as to panic instead of
+         * getting into an infinite faulting loop.
+         */
+        return EFAULT;
+    }
+
+    as = proc_getas();
+    if (as == NULL) {
+        /*
+         * No address space set up. This is probably also a
+         * kernel fault early in boot.
+         */
+        return EFAULT;
+    }
+
+    if (faulttype != VM_FAULT_READONLY) {
+        as->as_tlbmisses++;
+        vmstat_inc(VMS_TLBMISS);
+    }
+    vmstat_inc(faulttype == VM_FAULT_READ ? VMS_FAULTREAD :
+               faulttype == VM_FAULT_WRITE ? VMS_FAULTWRITE :
+               VMS_FAULTRDONLY);
+
+    rg = as_find_region(as, faultaddress);
+    if (rg == NULL) {
+        // just below the stack: grow it, unless that passes the limit
+        rg = as_grow_stack(as, faultaddress);
+        if (rg == NULL) {
+            return EFAULT;
+        }
+    }
+
+    if (faulttype != VM_FAULT_READ && !(rg->rg_perms & RG_W)) {
+        return EFAULT;
+    }
+
+    lock_acquire(as->as_lock);
+    result = vm_fault_page(as, rg, faulttype, faultaddress);
+    lock_release(as->as_lock);
+
+    return result;
+}
@@ -53,6 +53,7 @@
 #include <platform/bus.h>
 #include <vfs.h>
 #include <emufs.h>
+#include <pagecache.h>
 #include "autoconf.h"
 
 /* Register offsets */
@@ -261,6 +262,27 @@ emu_close(struct emu_softc *sc, uint32_t handle)
 	return result;
 }
 
+/*
+ * Copying to or from user memory can fault, and the fault may have to
+ * read a page of a program running off this very device, which needs
+ * e_lock again. So user transfers are staged in a kernel bounce buffer
+ * and copied with the lock released. Kernel buffers can't fault and
+ * are copied to or from the device buffer directly.
+ */
+static
+int
+emu_bounce_get(uint32_t len, struct uio *uio, void **ret)
+{
+	*ret = NULL;
+	if (uio->uio_segflg != UIO_SYSSPACE) {
+		*ret = kmalloc(len);
+		if (*ret == NULL) {
+			return ENOMEM;
+		}
+	}
+	return 0;
+}
+
 /*
  * Common code for read and readdir.
  */
@@ -269,6 +291,9 @@ int
 emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	   uint32_t op, struct uio *uio)
 {
+	void *bounce;
+	uint32_t got;
+	off_t newoffset;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_READ);
@@ -278,6 +303,11 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 		return 0;
 	}
 
+	result = emu_bounce_get(len, uio, &bounce);
+	if (result) {
+		return result;
+	}
+
 	lock_acquire(sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
@@ -286,16 +316,29 @@ emu_doread(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	emu_wreg(sc, REG_OPER, op);
 	result = emu_waitdone(sc);
 	if (result) {
+		lock_release(sc->e_lock);
 		goto out;
 	}
 
 	membar_load_load();
-	result = uiomove(sc->e_iobuf, emu_rreg(sc, REG_IOLEN), uio);
+	got = emu_rreg(sc, REG_IOLEN);
+	newoffset = emu_rreg(sc, REG_OFFSET);
+	if (bounce == NULL) {
+		result = uiomove(sc->e_iobuf, got, uio);
+	}
+	else {
+		memcpy(bounce, sc->e_iobuf, got);
+	}
 
-	uio->uio_offset = emu_rreg(sc, REG_OFFSET);
+	lock_release(sc->e_lock);
+
+	if (bounce != NULL) {
+		result = uiomove(bounce, got, uio);
+	}
+	uio->uio_offset = newoffset;
 
  out:
-	lock_release(sc->e_lock);
+	kfree(bounce);
 	return result;
 }
 
@@ -329,6 +372,8 @@ int
 emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 	  struct uio *uio)
 {
+	void *bounce;
+	off_t offset;
 	int result;
 
 	KASSERT(uio->uio_rw == UIO_WRITE);
@@ -337,23 +382,42 @@ emu_write(struct emu_softc *sc, uint32_t handle, uint32_t len,
 		return EFBIG;
 	}
 
+	offset = uio->uio_offset;
+	result = emu_bounce_get(len, uio, &bounce);
+	if (result) {
+		return result;
+	}
+	if (bounce != NULL) {
+		result = uiomove(bounce, len, uio);
+		if (result) {
+			kfree(bounce);
+			return result;
+		}
+	}
+
 	lock_acquire(sc->e_lock);
 
 	emu_wreg(sc, REG_HANDLE, handle);
 	emu_wreg(sc, REG_IOLEN, len);
-	emu_wreg(sc, REG_OFFSET, uio->uio_offset);
+	emu_wreg(sc, REG_OFFSET, offset);
 
-	result = uiomove(sc->e_iobuf, len, uio);
-	membar_store_store();
-	if (result) {
-		goto out;
+	if (bounce != NULL) {
+		memcpy(sc->e_iobuf, bounce, len);
+	}
+	else {
+		result = uiomove(sc->e_iobuf, len, uio);
+		if (result) {
+			goto out;
+		}
 	}
+	membar_store_store();
 
 	emu_wreg(sc, REG_OPER, EMU_OP_WRITE);
 	result = emu_waitdone(sc);
 
  out:
 	lock_release(sc->e_lock);
+	kfree(bounce);
 	return result;
 }
 
@@ -622,6 +686,9 @@ emufs_write(struct vnode *v, struct uio *uio)
 		}
 	}
 
+	/* Mappings made from now on must see the new contents. */
+	pagecache_invalidate(v);
+
 	return 0;
 }
 
@@ -725,6 +792,8 @@ int
 emufs_truncate(struct vnode *v, off_t len)
 {
 	struct emufs_vnode *ev = v->vn_data;
+
+	pagecache_invalidate(v);
 	return emu_trunc(ev->ev_emu, ev->ev_handle, len);
 }
 
@@ -848,10 +917,9 @@ emufs_namefile(struct vnode *v, struct uio *uio)
  */
 static
 int
-emufs_mmap(struct vnode *v)
+emufs_mmap(struct vnode *v, off_t offset, paddr_t *ret)
 {
-	(void)v;
-	return ENOSYS;
+	return pagecache_getpage(v, offset, ret);
 }
 
 //////////////////////////////
@@ -1121,7 +1189,7 @@ static const struct vnode_ops emufs_dirops = {
 	.vop_gettype = emufs_dir_gettype,
 	.vop_isseekable = emufs_isseekable,
 	.vop_fsync = emufs_void_op_isdir,
-	.vop_mmap = emufs_void_op_isdir,
+	.vop_mmap = vopfail_mmap_isdir,
 	.vop_truncate = emufs_truncate_isdir,
 	.vop_namefile = emufs_namefile,
 
@@ -40,6 +40,7 @@
 #include <uio.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <pagecache.h>
 #include "sfsprivate.h"
 
 ////////////////////////////////////////////////////////////
@@ -125,6 +126,9 @@ sfs_write(struct vnode *v, struct uio *uio)
 	result = sfs_io(sv, uio);
 	vfs_biglock_release();
 
+	/* Mappings made from now on must see the new contents. */
+	pagecache_invalidate(v);
+
 	return result;
 }
 
@@ -231,14 +235,14 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap() page faults. Pages are read through sfs_read
+ * into the vnode's page cache.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v, off_t offset, paddr_t *ret)
 {
-	(void)v;
-	return ENOSYS;
+	return pagecache_getpage(v, offset, ret);
 }
 
 /*
@@ -250,6 +254,7 @@ sfs_truncate(struct vnode *v, off_t len)
 {
 	struct sfs_vnode *sv = v->vn_data;
 
+	pagecache_invalidate(v);
 	return sfs_itrunc(sv, len);
 }
 
@@ -36,16 +36,68 @@
 
 
 #include <vm.h>
+#include <platform/maxcpus.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct pagetable;
+struct lock;
 
 
+/*
+ * Region of an address space, set up by as_define_region or
+ * as_define_stack. Pages in a region are only allocated when first
+ * touched; until then they have no page table entry.
+ *
+ * A region loaded from an executable also records where its contents
+ * live in the file: the RG_FILESZ bytes at virtual address
+ * RG_FILEVADDR come from offset RG_OFFSET of RG_VNODE. Everything
+ * else in the region (e.g. BSS) reads as zero.
+ *
+ * Pages of an RGF_PAGECACHE region instead come straight from the
+ * file's page cache through VOP_MMAP, mapped copy-on-write; such a
+ * region starts at a page-aligned RG_OFFSET and RG_FILEVADDR is
+ * RG_VBASE. RGF_MMAP marks regions made by mmap, which munmap may
+ * remove.
+ *
+ * Faults that walk through a region page by page are answered for
+ * several pages at once (see vm_fault). RG_FASTART and RG_FANEXT
+ * bound the pages the last fault mapped; a fault at RG_FANEXT
+ * continues the run and doubles RG_FAWINDOW, the number of extra
+ * pages mapped, up to RG_FAMAX. Any other fault outside the run
+ * starts over.
+ */
+struct region {
+        vaddr_t rg_vbase;               /* page-aligned start */
+        size_t rg_npages;
+        int rg_perms;                   /* RG_R | RG_W | RG_X */
+        int rg_flags;                   /* RGF_* */
+        struct vnode *rg_vnode;         /* backing file, or NULL */
+        off_t rg_offset;
+        vaddr_t rg_filevaddr;
+        size_t rg_filesz;
+        vaddr_t rg_fastart;             /* fault-around state */
+        vaddr_t rg_fanext;
+        unsigned rg_fawindow;
+        unsigned rg_famax;              /* 0 turns fault-around off */
+        struct region *rg_next;
+};
+
+#define RG_R    4
+#define RG_W    2
+#define RG_X    1
+
+#define RGF_PAGECACHE   1
+#define RGF_MMAP        2
+
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
  *
- * You write this.
+ * as_lock is held while the page table changes: by vm_fault, by
+ * as_copy and as_destroy, and by the page-out code in vm.c, which
+ * only ever try-acquires it so it can never deadlock against a
+ * faulting thread.
  */
 
 struct addrspace {
@@ -58,15 +110,19 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
-        // temporary from dumbvm
-        vaddr_t as_vbase1;
-        paddr_t as_pbase1;
-        size_t as_npages1;
-        vaddr_t as_vbase2;
-        paddr_t as_pbase2;
-        size_t as_npages2;
-        paddr_t as_stackpbase;
+        struct region *as_regions;      /* list of defined regions */
+        struct region *as_heap;         /* sbrk region; its end is the break */
+        struct region *as_stack;        /* grows down on faults... */
+        size_t as_stacklimit;           /* ...to at most this many pages */
+        struct pagetable *as_pt;        /* two-level page table */
+        struct lock *as_lock;           /* protects as_pt */
+        unsigned as_asid[MAXCPUS];      /* TLB address space ID per CPU... */
+        unsigned as_asidgen[MAXCPUS];   /* ...valid in this generation */
+        uint32_t as_cpumask;            /* CPUs that may hold our entries */
+        unsigned as_tlbmisses;          /* vm_fault calls for TLB misses */
+        unsigned as_tlbevictions;       /* misses that replaced an entry */
+        unsigned as_prefetched;         /* pages mapped by fault-around */
+        struct addrspace *as_next;      /* on the list of all of them */
 #endif
 };
 
@@ -107,6 +163,60 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_set_break - move the end of the heap region, which
+ *                as_complete_load places just past the last segment,
+ *                to the page-aligned address NEWBREAK. Pages are only
+ *                allocated when touched; shrinking frees the pages
+ *                beyond the new break.
+ *
+ *    as_mmap   - map NPAGES pages of file V from page-aligned OFFSET
+ *                at an unused address, which is handed back in RET.
+ *                PERMS are RG_* bits. Pages are shared with the file's
+ *                page cache copy-on-write.
+ *
+ *    as_munmap - remove the NPAGES-page mapping as_mmap made at VADDR.
+ *                Only whole mappings can be removed.
+ *
+ *    as_map_file - record that FILESZ bytes at VADDR are backed by
+ *                file V at OFFSET. VADDR must lie in a defined region.
+ *
+ *    as_share_file - like as_map_file, but if the region is read-only
+ *                and its pages line up with pages of the file, map
+ *                them from V's page cache so every address space
+ *                running the same program shares one copy.
+ *
+ *    as_find_region - return the region containing VADDR, or NULL.
+ *
+ *    as_grow_stack - extend the stack region down to take in VADDR, if
+ *                that keeps it within the stack limit. Returns the
+ *                stack region, or NULL if VADDR is not a stack address.
+ *
+ *    as_set_stacklimit - let the stack grow to NPAGES pages. Fails if
+ *                the stack is already bigger, or if the new limit (with
+ *                its guard page) would take in another region. fork
+ *                and exec keep the limit.
+ *
+ *    as_find_mapper - an address space whose page table maps VADDR to
+ *                PADDR, or NULL. The lookup takes no page table locks,
+ *                so the caller must keep the mapping from changing,
+ *                and check it again under as_lock.
+ *
+ *    as_set_faultaround - map at most NPAGES extra pages on sequential
+ *                faults in the region containing VADDR; 0 turns
+ *                fault-around off there. Set by madvise().
+ *
+ *    region_page_has_file - true if any of the page at VADDR in region
+ *                RG comes from its file, i.e. it does not start out as
+ *                all zeros.
+ *
+ *    region_fill_page - read the file contents, if any, of the page at
+ *                VADDR in region RG into physical page PADDR. The page
+ *                must already be zeroed.
+ *
+ *    region_fill_pages - the same for the NPAGES consecutive pages
+ *                starting at VADDR, whose frames are PADDRS, using a
+ *                single read of the file.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -125,6 +235,28 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+#if !OPT_DUMBVM
+int               as_map_file(struct addrspace *as, struct vnode *v,
+                              off_t offset, vaddr_t vaddr, size_t filesz);
+int               as_share_file(struct addrspace *as, struct vnode *v,
+                                off_t offset, vaddr_t vaddr, size_t filesz);
+struct region    *as_find_region(struct addrspace *as, vaddr_t vaddr);
+struct region    *as_grow_stack(struct addrspace *as, vaddr_t vaddr);
+int               as_set_stacklimit(struct addrspace *as, size_t npages);
+struct addrspace *as_find_mapper(vaddr_t vaddr, paddr_t paddr);
+int               as_set_faultaround(struct addrspace *as, vaddr_t vaddr,
+                                     unsigned npages);
+int               as_set_break(struct addrspace *as, vaddr_t newbreak);
+int               as_mmap(struct addrspace *as, struct vnode *v, off_t offset,
+                          size_t npages, int perms, vaddr_t *ret);
+int               as_munmap(struct addrspace *as, vaddr_t vaddr,
+                            size_t npages);
+bool              region_page_has_file(struct region *rg, vaddr_t vaddr);
+int               region_fill_page(struct region *rg, vaddr_t vaddr,
+                                   paddr_t paddr);
+int               region_fill_pages(struct region *rg, vaddr_t vaddr,
+                                    const paddr_t *paddrs, unsigned npages);
+#endif
 
 
 /*
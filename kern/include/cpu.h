@@ -35,6 +35,8 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+/* Number of scheduling priorities, each with its own run queue. */
+#define CPU_NPRIORITIES 4
 
 /*
  * Per-cpu structure
@@ -60,14 +62,25 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	unsigned c_schedules;		/* Counter of schedule() calls */
 	unsigned c_spinlocks;		/* Counter of spinlocks held */
+	unsigned c_exited;		/* Threads destroyed here */
+	unsigned c_exitmigrations;	/* ...and their t_migrations */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
+	 *
+	 * There is a run queue for each priority, 0 being the
+	 * highest; see schedule() in thread.c.
+	 *
+	 * c_isidle and c_runcount are also read without the lock, by
+	 * cpus looking for work or for somewhere to send it; what they
+	 * see then is only an estimate.
 	 */
-	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	volatile bool c_isidle;		/* True if this cpu is idle */
+	struct threadlist c_runqueue[CPU_NPRIORITIES]; /* Run queues */
+	volatile unsigned c_runcount;	/* Threads on all the run queues */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -110,6 +123,12 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Look up a CPU by its software number (c_number); NULL if there is
+ * no such CPU.
+ */
+struct cpu *cpu_bynumber(unsigned num);
+
 /*
  * Produce a string describing the CPU type.
  */
@@ -153,6 +172,7 @@ void cpu_halt(void);
  * ipi_send sends an IPI to one CPU.
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
+ * ipi_tlbshootdown_batch queues several mappings with a single IPI.
  *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
@@ -167,6 +187,8 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_batch(struct cpu *target,
+			    const struct tlbshootdown *mappings, unsigned n);
 
 void interprocessor_interrupt(void);
 
@@ -17,10 +17,13 @@ struct file_entry {
 };
 
 struct file_table {
-    struct lock *ft_lock;
+    struct rwlock *ft_lock;    // read to look up entries, write to change them
     struct file_entry *ft_entries[OPEN_MAX];
 };
 
+// Set up the allocator for file entries
+void ft_bootstrap(void);
+
 // File Table functions
 struct file_table *ft_create(void);
 void ft_destroy(struct file_table *ft);
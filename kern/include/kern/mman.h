@@ -0,0 +1,26 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Flags for mmap() and madvise(), shared between the kernel and libc.
+ */
+
+/* Page protections (PROT argument) */
+#define PROT_NONE       0x0
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+#define PROT_EXEC       0x4
+
+/* Mapping type (FLAGS argument); exactly one must be given */
+#define MAP_SHARED      0x1     /* changes reach the file (read-only only) */
+#define MAP_PRIVATE     0x2     /* changes are private copy-on-write */
+
+/* Returned by libc's mmap() on failure */
+#define MAP_FAILED      ((void *)-1)
+
+/* Access patterns (madvise ADVICE argument); they set fault-around */
+#define MADV_NORMAL     0       /* map ahead of sequential faults */
+#define MADV_RANDOM     1       /* map only the page faulted on */
+
+
+#endif /* _KERN_MMAN_H_ */
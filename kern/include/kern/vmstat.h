@@ -0,0 +1,48 @@
+#ifndef _KERN_VMSTAT_H_
+#define _KERN_VMSTAT_H_
+
+/*
+ * VM statistics, as returned by the vmstat() system call and printed
+ * by the kernel menu's vmstat command. Counters only ever go up, so a
+ * benchmark takes a snapshot before and after a run and subtracts.
+ * The per-process counts at the end are only filled in by the system
+ * call.
+ */
+
+/* Indexes into vms_count */
+#define VMS_TLBMISS      0      /* vm_fault calls for TLB misses */
+#define VMS_FAULTREAD    1      /* faults by type */
+#define VMS_FAULTWRITE   2
+#define VMS_FAULTRDONLY  3
+#define VMS_ZEROFILL     4      /* fresh pages that started as zeros */
+#define VMS_FILEFILL     5      /* fresh pages read from a file */
+#define VMS_ZEROPAGE     6      /* reads that mapped the shared zero page */
+#define VMS_PAGECACHE    7      /* pages mapped from a file's page cache */
+#define VMS_FAULTAROUND  8      /* pages mapped ahead of a fault */
+#define VMS_COWCOPY      9      /* copy-on-write breaks that copied */
+#define VMS_COWCLAIM     10     /* ...that took over the last reference */
+#define VMS_EVICT        11     /* pages taken out of memory */
+#define VMS_SWAPOUT      12     /* pages written to swap */
+#define VMS_SWAPIN       13     /* pages read back from swap */
+#define VMS_SHOOTDOWN    14     /* TLB shootdown IPIs sent */
+#define VMS_RECLAIM      15     /* page-outs done by allocating threads */
+#define VMS_NCOUNTERS    16
+
+struct vmstat {
+	unsigned vms_count[VMS_NCOUNTERS];
+	unsigned vms_totalpages;        /* pages of RAM the coremap manages */
+	unsigned vms_freepages;         /* ...that are free */
+	unsigned vms_zeroedpages;       /* ...of which already zeroed */
+	unsigned vms_lowater;           /* page-out daemon wakes below this */
+	unsigned vms_hiwater;           /* ...and runs until this many are free */
+	unsigned vms_swapslots;         /* pages of swap */
+	unsigned vms_swapused;          /* ...in use */
+
+	/* The calling process's own counts, since its fork or exec */
+	unsigned vms_tlbmisses;         /* TLB misses */
+	unsigned vms_tlbevictions;      /* ...that replaced a valid entry */
+	unsigned vms_faultaround;       /* pages mapped ahead of faults */
+};
+
+
+#endif /* _KERN_VMSTAT_H_ */
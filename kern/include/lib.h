@@ -125,6 +125,11 @@ uint32_t random(void);
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
  * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ * Likewise kheap_printsizes and clearsizes need SIZEHIST.
+ *
+ * kheap_profile turns on counting of memory use by allocation site
+ * (which also needs LABELS); kheap_printprofile prints the N sites
+ * holding the most.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
@@ -132,6 +137,26 @@ void kheap_printstats(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+void kheap_printsizes(void);
+void kheap_clearsizes(void);
+void kheap_profile(bool on);
+void kheap_resetprofile(void);
+void kheap_printprofile(unsigned n);
+
+/*
+ * Object caches, for kernel structures that are made and destroyed
+ * often. Freed objects are kept in the state CTOR puts them in
+ * (e.g. with their locks already made) and reused. CTOR returns 0 or
+ * an error code; either function may be NULL. Usage statistics are
+ * printed by kheap_printstats.
+ */
+struct kmem_cache;
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+				     int (*ctor)(void *obj),
+				     void (*dtor)(void *obj));
+void kmem_cache_destroy(struct kmem_cache *kc);
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
 
 /*
  * C string functions.
@@ -0,0 +1,46 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+/*
+ * Per-vnode cache of file pages, shared by every mmap of the file.
+ *
+ * A cached page is a user frame with no owner. Each address space
+ * that maps it takes a reference and maps it copy-on-write. Writing or
+ * truncating the file drops the cache's references, so pages that are
+ * still mapped stay with their mappers as private copies, and later
+ * faults read the new contents.
+ *
+ * Under memory pressure the clock takes back cached pages that nobody
+ * else maps (or only their first mapper; see vm.h) with
+ * pagecache_reclaim, so a file bigger than memory can be mapped.
+ */
+
+struct pagecache;
+
+#include <types.h>
+
+struct vnode;
+
+/*
+ * Return in RET the frame holding the page of V at OFFSET, with a
+ * reference for the caller; for filesystems' VOP_MMAP.
+ */
+int pagecache_getpage(struct vnode *v, off_t offset, paddr_t *ret);
+
+/*
+ * Drop the page at OFFSET from PC if it is still cached as PADDR. The
+ * cache's reference to the frame passes to the caller. Gives up rather
+ * than wait for the cache's lock, as the page-out code calls it; the
+ * caller has the page marked busy, which keeps PC from being freed.
+ * Returns true if the page was dropped.
+ */
+bool pagecache_reclaim(struct pagecache *pc, off_t offset, paddr_t paddr);
+
+/* Forget every cached page of V. */
+void pagecache_invalidate(struct vnode *v);
+
+/* Free V's page cache; called by vnode_cleanup. */
+void pagecache_destroy(struct vnode *v);
+
+
+#endif /* _PAGECACHE_H_ */
@@ -0,0 +1,78 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+/*
+ * Two-level page table for a user address space.
+ *
+ * The top 10 bits of a virtual address index the directory, the next
+ * 10 bits index a second-level table, and the low 12 bits are the page
+ * offset. Second-level tables are only allocated once a page in their
+ * 4M range is touched, so sparse address spaces stay cheap.
+ */
+
+#include <types.h>
+#include <vm.h>
+
+typedef uint32_t pte_t;
+
+#define PT_L1_SIZE          1024
+#define PT_L2_SIZE          1024
+#define PT_L1_INDEX(vaddr)  (((vaddr) >> 22) & 0x3ff)
+#define PT_L2_INDEX(vaddr)  (((vaddr) >> 12) & 0x3ff)
+#define PT_VADDR(l1, l2)    (((vaddr_t)(l1) << 22) | ((vaddr_t)(l2) << 12))
+
+/*
+ * Fields in a page table entry. A page that has been paged out is not
+ * PTE_VALID; instead PTE_SWAPPED is set and the frame bits hold its
+ * swap slot. An entry of 0 has never been touched (or was clean and
+ * dropped) and is filled from zero or the region's file.
+ */
+#define PTE_FRAME           0xfffff000  /* physical page address */
+#define PTE_VALID           0x00000001  /* page is resident at PTE_FRAME */
+#define PTE_COW             0x00000002  /* shared; copy before writing */
+#define PTE_SWAPPED         0x00000004  /* not resident; in swap slot */
+#define PTE_DIRTY           0x00000008  /* written since it was filled */
+
+#define PTE_SLOT(pte)       ((pte) >> 12)
+#define PTE_MKSWAP(slot)    (((pte_t)(slot) << 12) | PTE_SWAPPED)
+
+struct pagetable {
+    pte_t *pt_dir[PT_L1_SIZE];
+};
+
+/* Create an empty page table; NULL on out-of-memory. */
+struct pagetable *pt_create(void);
+
+/*
+ * Free the table along with every page AS maps through it, in memory
+ * or in swap.
+ */
+void pt_destroy(struct pagetable *pt, struct addrspace *as);
+
+/*
+ * Clear the entries for every page from START up to END, freeing the
+ * memory or swap slots AS had there. The caller holds AS's lock and
+ * must flush the TLB.
+ */
+void pt_unmap(struct pagetable *pt, struct addrspace *as,
+              vaddr_t start, vaddr_t end);
+
+/*
+ * Find the entry for VADDR. If the second-level table does not exist
+ * it is allocated when CREATE is set; otherwise NULL is returned. NULL
+ * is also returned if the allocation fails.
+ */
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create);
+
+/*
+ * Make NEW map every page OLD maps. Resident pages are shared
+ * copy-on-write: both entries get PTE_COW and the frame gains a
+ * reference. Swapped-out pages share the swap slot, and each side
+ * reads it into a frame of its own when it next faults. The caller
+ * holds both address space locks and must flush stale writable TLB
+ * entries.
+ */
+int pt_copy(struct pagetable *old, struct pagetable *new);
+
+
+#endif /* _PAGETABLE_H_ */
@@ -0,0 +1,44 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+/*
+ * Swap space: the whole of a second disk, divided into page-sized
+ * slots tracked by a bitmap. Pages are written out by the page
+ * replacement code in vm.c and read back in by vm_fault.
+ *
+ * A slot is never written once it holds a page, so fork shares it
+ * between parent and child instead of reading it in; each slot counts
+ * the page table entries and coremap entries that refer to it.
+ */
+
+#include <types.h>
+
+#define SWAP_DEVICE     "lhd1raw:"
+
+/*
+ * Open the swap disk. Called once devices have been probed; if there
+ * is no swap disk, paging out is disabled and the VM runs in RAM only.
+ */
+void swap_bootstrap(void);
+
+/* True if swap_bootstrap found a swap disk. */
+bool swap_enabled(void);
+
+/* Reserve a free slot holding one reference; ENOSPC if full or disabled. */
+int swap_alloc(unsigned *slot);
+
+/* Add a reference to a slot in use. */
+void swap_incref(unsigned slot);
+
+/* Drop a reference to a slot, releasing it with the last one. */
+void swap_free(unsigned slot);
+
+/* Report the size of swap and how many slots are in use. */
+void swap_usage(unsigned *nslots, unsigned *nused);
+
+/* Copy the physical page at PADDR to SLOT, or back again. */
+int swap_out(paddr_t paddr, unsigned slot);
+int swap_in(unsigned slot, paddr_t paddr);
+
+
+#endif /* _SWAP_H_ */
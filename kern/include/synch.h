@@ -37,6 +37,9 @@
 
 #include <spinlock.h>
 
+/* Set up the allocators for locks and CVs. */
+void synch_bootstrap(void);
+
 /*
  * Dijkstra-style semaphore.
  *
@@ -71,6 +74,12 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks are adaptive: a thread that finds the lock held by a thread
+ * running on another cpu spins for a while, as the holder is likely
+ * to release it soon, and only sleeps if the holder is not running or
+ * the spin runs out. lk_spins counts acquisitions that waited by
+ * spinning alone, lk_blocks the times a thread went to sleep.
  */
 struct lock {
         char *lk_name;
@@ -79,7 +88,8 @@ struct lock {
         struct wchan *lk_wchan;
         struct spinlock lk_lock;
         struct thread *volatile lk_holder;
-        
+        unsigned lk_spins;
+        unsigned lk_blocks;
 };
 
 struct lock *lock_create(const char *name);
@@ -89,6 +99,8 @@ void lock_destroy(struct lock *);
  * Operations:
  *    lock_acquire - Get the lock. Only one thread can hold the lock at the
  *                   same time.
+ *    lock_tryacquire - Get the lock if nobody holds it and return true;
+ *                   otherwise return false without waiting.
  *    lock_release - Free the lock. Only the thread holding the lock may do
  *                   this.
  *    lock_do_i_hold - Return true if the current thread holds the lock;
@@ -97,6 +109,7 @@ void lock_destroy(struct lock *);
  * These operations must be atomic. You get to write them.
  */
 void lock_acquire(struct lock *);
+bool lock_tryacquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 
@@ -144,4 +157,52 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers can hold the lock at once, or one writer.
+ * Writers take precedence: once a writer is waiting, new readers wait
+ * behind it, so a steady stream of readers cannot starve writers.
+ *
+ * Ordinarily the readers are counted in rw_readers, under rw_lock.
+ * A lock made with rwlock_create_percpu instead counts them on each
+ * cpu separately, so readers on different cpus never touch the same
+ * memory unless a writer is around; writers pay for this by having
+ * to visit every cpu's count. Use it for data that is read far more
+ * often than it is written.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+struct rwlock_cpu;
+
+struct rwlock {
+        char *rwlock_name;
+        struct spinlock rw_lock;
+        struct wchan *rw_readwchan;     /* readers waiting */
+        struct wchan *rw_writewchan;    /* writers waiting */
+        unsigned rw_readers;            /* readers holding the lock */
+        volatile unsigned rw_writers;   /* writers holding or waiting */
+        struct thread *rw_writer;       /* writer holding the lock */
+        struct rwlock_cpu *rw_cpus;     /* per-cpu reader counts, or NULL */
+};
+
+struct rwlock *rwlock_create(const char *name);
+struct rwlock *rwlock_create_percpu(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading; waits while a
+ *                           writer holds it or is waiting for it.
+ *    rwlock_release_read  - Give up a read hold.
+ *    rwlock_acquire_write - Get the lock for exclusive use.
+ *    rwlock_release_write - Give up the write hold.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
@@ -47,6 +47,9 @@ void syscall(struct trapframe *tf);
 /* Helper for fork(). You write this. */
 void enter_forked_process(struct trapframe *tf);
 
+/* Set up fork's object cache; called by proc_bootstrap. */
+void fork_bootstrap(void);
+
 /* Enter user mode. Does not return. */
 __DEAD void enter_new_process(int argc, userptr_t argv, userptr_t env,
 		       vaddr_t stackptr, vaddr_t entrypoint);
@@ -76,4 +79,14 @@ int sys_execv(const char *program, char **args);
 int sys_waitpid(pid_t pid, int *status, int options);
 void sys__exit(int waitcode); 
 
+// vm syscalls, not available with dumbvm
+int sys_sbrk(intptr_t amount, int *retval);
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+             off_t offset, int *retval);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_madvise(userptr_t addr, size_t len, int advice);
+int sys_vmstat(userptr_t buf);
+int sys_getrlimit(int resource, userptr_t rlp);
+int sys_setrlimit(int resource, const_userptr_t rlp);
+
 #endif /* _SYSCALL_H_ */
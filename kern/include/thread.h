@@ -84,6 +84,14 @@ struct thread {
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
 
+	/*
+	 * Scheduler fields, protected by t_cpu's run queue lock.
+	 */
+	unsigned t_priority;		/* Run queue; 0 is the highest */
+	unsigned t_ticks;		/* Hardclocks used at this priority */
+	unsigned t_lastrun;		/* t_cpu's c_hardclocks when last run */
+	unsigned t_migrations;		/* Times moved to another cpu */
+
 	/*
 	 * Interrupt state fields.
 	 *
@@ -157,6 +165,12 @@ __DEAD void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Charge the current thread for a hardclock, yielding if it has used
+ * up its time slice. Called from the timer interrupt.
+ */
+void thread_tick(void);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
@@ -168,5 +182,11 @@ void schedule(void);
  */
 void thread_consider_migration(void);
 
+/*
+ * Print each cpu's running and ready threads with how often they have
+ * migrated between cpus, and totals for threads that have exited.
+ */
+void thread_printstats(void);
+
 
 #endif /* _THREAD_H_ */
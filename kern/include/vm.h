@@ -40,35 +40,205 @@
 #include <machine/vm.h>
 #include <spinlock.h>
 
+struct addrspace;
+struct pagecache;
+struct vmstat;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
 #define VM_FAULT_READONLY    2    /* A write to a readonly page was attempted*/
 
-#define COREMAP_PAGES        8
-#define NUM_PPAGES           COREMAP_PAGES * PAGE_SIZE / 8
+/*
+ * User stack. The stack region starts out VM_STACKPAGES long and grows
+ * down when faults land below it, up to the address space's stack
+ * limit: VM_STACKLIMIT pages unless changed with setrlimit(RLIMIT_STACK).
+ * The page below the limit is a guard page that nothing is ever mapped
+ * at, so running off the end of the stack faults instead of running
+ * into other memory. Pages are only allocated when touched. (The limit
+ * must be > 64K so argument blocks of size ARG_MAX will fit.)
+ */
+#define VM_STACKPAGES        1
+#define VM_STACKLIMIT        256
+
+/* Most pages a sequential fault maps beyond the one faulted on. */
+#define VM_FAULTAROUND_MAX   16
+
+/*
+ * Coremap: one entry for every physical page of RAM, allocated by
+ * vm_bootstrap once ram_getsize() is known.
+ *
+ * Free pages are kept on a doubly-linked list threaded through the
+ * entries by page number, so allocating or freeing a single page is
+ * O(1). Multi-page runs (kmalloc's large path) are found by scanning
+ * for enough consecutive free pages and unlinking each of them.
+ *
+ * cme_npages is only meaningful on the first page of an allocated
+ * run; it records how many pages coremap_free must release.
+ *
+ * cme_refcount counts the page tables mapping a user page. Fork
+ * shares pages copy-on-write, so one frame can belong to several
+ * address spaces; cme_as is then just one of them. coremap_free drops
+ * one reference and only frees the run when the last one goes.
+ *
+ * User pages mapped by a single address space can be paged out. The
+ * clock hand sweeps the coremap; a page with cme_referenced set (it
+ * was faulted on since the last sweep) gets a second chance. A page
+ * being paged out is cme_busy, and cme_swapslot remembers the slot
+ * holding an up-to-date copy of a clean page so it can be dropped
+ * without writing it again. When cme_as drops a page others still
+ * share, the page is marked cme_orphan; once only one sharer is left,
+ * the clock finds it by looking up cme_vaddr, which fork keeps the
+ * same in every sharer.
+ *
+ * A page in a file's page cache records the cache and the file offset
+ * in cme_cache and cme_offset. Its cme_as is the address space that
+ * first mapped it, if that is still the only one. The clock reclaims
+ * such a page when it is either only in the cache, or also mapped by
+ * cme_as: it drops the page from the cache, unmaps it there and frees
+ * it. The next fault reads it back in through the cache.
+ *
+ * Free pages known to be zero-filled sit on a second list, cm_zerolist,
+ * which idle cpus top up in the background so faults on fresh
+ * anonymous memory don't have to clear a page themselves. Reads of
+ * such memory don't get a page at all until written: they map one
+ * shared, read-only zero page copy-on-write.
+ */
+typedef enum {
+    CM_FREE,            /* on the free list */
+    CM_FIXED,           /* kernel memory, never paged */
+    CM_USER,            /* user page belonging to cme_as */
+} cm_state_t;
 
-#define PP_USED              0x80000000
-#define KMALLOC_END          0x40000000
-#define DIRTY                0x20000000
+#define CM_NOPAGE            ((p_page_t)-1)
+#define CM_NOSLOT            ((unsigned)-1)
 
+struct cm_entry {
+    struct addrspace *cme_as;   /* owner; NULL for kernel pages */
+    vaddr_t cme_vaddr;          /* virtual address of the page */
+    cm_state_t cme_state;
+    unsigned cme_npages;        /* length of run starting here */
+    unsigned cme_refcount;      /* page tables sharing this page */
+    unsigned cme_swapslot;      /* clean copy in swap, or CM_NOSLOT */
+    struct pagecache *cme_cache; /* page cache holding the page, or NULL */
+    off_t cme_offset;           /* ...and its offset in the file */
+    bool cme_orphan;            /* cme_as is gone but others still map it */
+    bool cme_busy;              /* being paged out */
+    bool cme_referenced;        /* faulted on since the clock passed */
+    bool cme_zeroed;            /* free and on cm_zerolist */
+    p_page_t cme_prev;          /* free list links */
+    p_page_t cme_next;
+};
 
 struct coremap {
-    cm_entry_t cm_entries[NUM_PPAGES];
+    struct cm_entry *cm_entries;
     struct spinlock cm_spinlock;
-    volatile size_t cm_counter;
+    p_page_t cm_first;          /* first page the coremap hands out */
+    p_page_t cm_last;           /* one past the last page of RAM */
+    p_page_t cm_freelist;       /* head of the free list */
+    p_page_t cm_zerolist;       /* head of the list of zeroed free pages */
+    unsigned cm_nzeroed;        /* pages on cm_zerolist */
+    p_page_t cm_clockhand;      /* next page the clock looks at */
+    volatile size_t cm_counter; /* pages in use */
 };
 
 /* Initialization function */
 void vm_bootstrap(void);
 
+/*
+ * Start the VM's background work, the page-out daemon and the zeroing
+ * of free pages; called once threads can be forked and swap is open.
+ */
+void vm_start_threads(void);
+
+/*
+ * Clear a few free pages for later zero-fill faults if the pool of
+ * them is low. Called from the idle loop; returns true if it did any
+ * work, false if there was none to do.
+ */
+bool vm_idle_zero(void);
+
+/*
+ * Set the free page counts below which the page-out daemon wakes
+ * (LOWATER) and up to which it then pages out (HIWATER).
+ */
+int vm_set_watermarks(unsigned lowater, unsigned hiwater);
+
 /* Fault handling function called by trap code */
 int vm_fault(int faulttype, vaddr_t faultaddress);
 
+/*
+ * Allocate/free runs of physical pages through the coremap. AS and
+ * VADDR record the owner; pass NULL for kernel memory. If no run of
+ * NPAGES free pages exists and the caller may sleep, user pages are
+ * paged out to make room; returns 0 if that does not help.
+ */
+paddr_t coremap_alloc(unsigned npages, struct addrspace *as, vaddr_t vaddr);
+void coremap_free(paddr_t paddr);
+
+/*
+ * Allocate a zero-filled user page, as coremap_alloc(1, AS, VADDR).
+ * Comes from the pre-zeroed pool when it can.
+ */
+paddr_t coremap_alloc_zeroed(struct addrspace *as, vaddr_t vaddr);
+
+/*
+ * Allocate a user page that belongs to no address space, for the page
+ * cache. Pages without an owner are never paged out unless they are
+ * entered in a cache with coremap_setcache.
+ */
+paddr_t coremap_alloc_shared(void);
+
+/*
+ * Record that the page at PADDR is cached by PC at file OFFSET, which
+ * lets the clock reclaim it; PC is NULL when it leaves the cache.
+ */
+void coremap_setcache(paddr_t paddr, struct pagecache *pc, off_t offset);
+
+/*
+ * Drop AS's reference to the user page at PADDR, as coremap_free,
+ * waiting first if the page is in the middle of being paged out.
+ */
+void coremap_release(paddr_t paddr, struct addrspace *as);
+
+/* Add a reference to a shared user page. */
+void coremap_incref(paddr_t paddr);
+
+/*
+ * If AS holds the only reference to the user page at PADDR, make it
+ * the recorded owner at VADDR and return true.
+ */
+bool coremap_claim(paddr_t paddr, struct addrspace *as, vaddr_t vaddr);
+
 /* Allocate/free kernel heap pages (called by kmalloc/kfree) */
 vaddr_t alloc_kpages(unsigned npages);
 void free_kpages(vaddr_t addr);
 
+/*
+ * Make AS's translations the ones the TLB uses on this CPU, giving it
+ * an address space ID if it has none that is valid here.
+ */
+void vm_tlb_activate(struct addrspace *as);
+
+/* Discard every TLB entry of AS, e.g. after write-protecting pages. */
+void vm_tlb_invalidate(struct addrspace *as);
+
+/*
+ * Discard AS's TLB entries for the pages in [START, END) on every CPU
+ * that may hold them, and wait until they are gone. The caller holds
+ * AS's lock; ranges of more than a few pages fall back on
+ * vm_tlb_invalidate, so they may only be unmapped by AS's own thread.
+ */
+void vm_tlb_unmap(struct addrspace *as, vaddr_t start, vaddr_t end);
+
+/*
+ * VM statistics (see <kern/vmstat.h>). Counters are kept per CPU and
+ * only added up by vmstat_get, so bumping one is cheap.
+ */
+void vmstat_inc(unsigned which);
+void vmstat_add(unsigned which, unsigned n);
+void vmstat_get(struct vmstat *vs);
+
 /* TLB shootdown handling called from interprocessor_interrupt */
 void vm_tlbshootdown_all(void);
 void vm_tlbshootdown(const struct tlbshootdown *);
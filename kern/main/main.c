@@ -49,7 +49,9 @@
 #include <syscall.h>
 #include <test.h>
 #include <version.h>
+#include <swap.h>
 #include "autoconf.h"  // for pseudoconfig
+#include "opt-dumbvm.h"
 
 
 /*
@@ -108,6 +110,7 @@ boot(void)
 	/* Early initialization. */
 	ram_bootstrap();
     vm_bootstrap();
+	synch_bootstrap();
 	proc_bootstrap();
 	thread_bootstrap();
 	hardclock_bootstrap();
@@ -132,6 +135,12 @@ boot(void)
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
 
+#if !OPT_DUMBVM
+	/* Page out to the second disk, if there is one */
+	swap_bootstrap();
+	vm_start_threads();
+#endif
+
 	kheap_nextgeneration();
 
 	/*
@@ -31,6 +31,7 @@
 #include <kern/errno.h>
 #include <kern/reboot.h>
 #include <kern/unistd.h>
+#include <kern/vmstat.h>
 #include <limits.h>
 #include <lib.h>
 #include <uio.h>
@@ -41,8 +42,10 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <vm.h>
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-dumbvm.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -387,6 +390,81 @@ cmd_kheapgeneration(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_threadstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printstats();
+
+	return 0;
+}
+
+#if !OPT_DUMBVM
+static
+int
+cmd_vmstat(int nargs, char **args)
+{
+	static const char *const names[VMS_NCOUNTERS] = {
+		"TLB misses",
+		"read faults",
+		"write faults",
+		"read-only faults",
+		"zero-filled pages",
+		"pages read from files",
+		"zero page mappings",
+		"page cache mappings",
+		"pages faulted around",
+		"copy-on-write copies",
+		"copy-on-write claims",
+		"evictions",
+		"swap outs",
+		"swap ins",
+		"TLB shootdowns sent",
+		"page-outs by allocating threads",
+	};
+	struct vmstat vs;
+	unsigned i;
+
+	(void)nargs;
+	(void)args;
+
+	vmstat_get(&vs);
+
+	kprintf("Pages: %u total, %u free (%u zeroed)\n",
+		vs.vms_totalpages, vs.vms_freepages, vs.vms_zeroedpages);
+	kprintf("Page-out watermarks: %u low, %u high\n",
+		vs.vms_lowater, vs.vms_hiwater);
+	kprintf("Swap: %u of %u slots used\n",
+		vs.vms_swapused, vs.vms_swapslots);
+	for (i=0; i<VMS_NCOUNTERS; i++) {
+		kprintf("%10u %s\n", vs.vms_count[i], names[i]);
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_vmwater(int nargs, char **args)
+{
+	int result;
+
+	if (nargs != 3) {
+		kprintf("Usage: vmwater low high\n");
+		return EINVAL;
+	}
+
+	result = vm_set_watermarks(atoi(args[1]), atoi(args[2]));
+	if (result) {
+		kprintf("vmwater: %s\n", strerror(result));
+	}
+	return result;
+}
+#endif
+
 static
 int
 cmd_kheapdump(int nargs, char **args)
@@ -404,6 +482,49 @@ cmd_kheapdump(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kheapsizes(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kheap_printsizes();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "clear")) {
+		kheap_clearsizes();
+	}
+	else {
+		kprintf("Usage: khsizes [clear]\n");
+	}
+
+	return 0;
+}
+
+static
+int
+cmd_kheapprofile(int nargs, char **args)
+{
+	if (nargs == 1) {
+		kheap_printprofile(20);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "on")) {
+		kheap_profile(true);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "off")) {
+		kheap_profile(false);
+	}
+	else if (nargs == 2 && !strcmp(args[1], "reset")) {
+		kheap_resetprofile();
+	}
+	else if (nargs == 2 && atoi(args[1]) > 0) {
+		kheap_printprofile(atoi(args[1]));
+	}
+	else {
+		kprintf("Usage: khprof [on | off | reset | count]\n");
+	}
+
+	return 0;
+}
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -477,6 +598,7 @@ static const char *testmenu[] = {
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
 	"[sy4] CV test #2            (1)     ",
+	"[sy5] RW lock throughput test       ",
 	"[fs1] Filesystem test               ",
 	"[fs2] FS read stress                ",
 	"[fs3] FS write stress               ",
@@ -507,6 +629,13 @@ static const char *mainmenu[] = {
 	"[kh] Kernel heap stats              ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khsizes] Kernel heap size classes  ",
+	"[khprof] Kernel heap profile        ",
+	"[threads] Thread placement stats    ",
+#if !OPT_DUMBVM
+	"[vmstat] VM statistics              ",
+	"[vmwater] Set page-out watermarks   ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -556,6 +685,13 @@ static struct {
 	{ "kh",         cmd_kheapstats },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khsizes",    cmd_kheapsizes },
+	{ "khprof",     cmd_kheapprofile },
+	{ "threads",    cmd_threadstats },
+#if !OPT_DUMBVM
+	{ "vmstat",     cmd_vmstat },
+	{ "vmwater",    cmd_vmwater },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -577,6 +713,7 @@ static struct {
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
 	{ "sy4",	cvtest2 },
+	{ "sy5",	rwtest },
 
 	/* file system assignment tests */
 	{ "fs1",	fstest },
@@ -16,7 +16,7 @@ struct file_table *ft_create()
         return NULL;
     }
 
-    ft->ft_lock = lock_create("fs_lock");
+    ft->ft_lock = rwlock_create("fs_lock");
     if (ft->ft_lock == NULL) {
         kfree(ft);
         return NULL;
@@ -51,11 +51,46 @@ void ft_destroy(struct file_table *ft)
         }   
     }
     if (free) {
-        lock_destroy(ft->ft_lock);
+        rwlock_destroy(ft->ft_lock);
         kfree(ft);
     }
 }
 
+/*
+ * File entries are cached with their locks already made
+ */
+static struct kmem_cache *entry_cache;
+
+static int entry_ctor(void *obj)
+{
+    struct file_entry *entry = obj;
+
+    entry->entry_lock = lock_create("file entry lock");
+    if (entry->entry_lock == NULL) {
+        return ENOMEM;
+    }
+    return 0;
+}
+
+static void entry_dtor(void *obj)
+{
+    struct file_entry *entry = obj;
+
+    lock_destroy(entry->entry_lock);
+}
+
+/*
+ * Set up the file entry cache
+ */
+void ft_bootstrap(void)
+{
+    entry_cache = kmem_cache_create("file_entry", sizeof(struct file_entry),
+                                    entry_ctor, entry_dtor);
+    if (entry_cache == NULL) {
+        panic("ft_bootstrap: Out of memory\n");
+    }
+}
+
 /*
  * Create a new file entry with a given vnode
  */
@@ -65,17 +100,11 @@ struct file_entry *entry_create(struct vnode *vnode)
 
     struct file_entry *entry;
 
-    entry = kmalloc(sizeof(struct file_entry));
+    entry = kmem_cache_alloc(entry_cache);
     if (entry == NULL) {
         return NULL;
     }
 
-    entry->entry_lock = lock_create("file entry lock");
-    if (entry->entry_lock == NULL) {
-        kfree(entry);
-        return NULL;
-    } 
-
     entry->file = vnode;
     entry->offset = 0;
     entry->ref_count = 0;
@@ -96,8 +125,7 @@ void entry_destroy(struct file_entry *entry)
         entry = NULL;
         return;
     }
-    lock_destroy(entry->entry_lock);
-    kfree(entry);
+    kmem_cache_free(entry_cache, entry);
 }
 
 /*
@@ -50,6 +50,7 @@
 #include <vnode.h>
 #include <limits.h>
 #include <kern/errno.h>
+#include <syscall.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -58,6 +59,38 @@ struct proc *kproc;
 
 struct pid_table *pid_table;
 
+/*
+ * Every fork and exit makes and destroys a proc, so they are cached
+ * with their thread and child arrays and p_lock already set up.
+ */
+static struct kmem_cache *proc_cache;
+
+static
+int
+proc_ctor(void *obj)
+{
+	struct proc *proc = obj;
+
+	proc->p_children = array_create();
+	if (proc->p_children == NULL) {
+		return ENOMEM;
+	}
+	threadarray_init(&proc->p_threads);
+	spinlock_init(&proc->p_lock);
+	return 0;
+}
+
+static
+void
+proc_dtor(void *obj)
+{
+	struct proc *proc = obj;
+
+	threadarray_cleanup(&proc->p_threads);
+	spinlock_cleanup(&proc->p_lock);
+	array_destroy(proc->p_children);
+}
+
 /*
  * Create a proc structure.
  */
@@ -66,33 +99,22 @@ proc_create(const char *name)
 {
 	struct proc *proc;
 
-	proc = kmalloc(sizeof(*proc));
+	proc = kmem_cache_alloc(proc_cache);
 	if (proc == NULL) {
 		return NULL;
 	}
 	proc->p_name = kstrdup(name);
 	if (proc->p_name == NULL) {
-		kfree(proc);
+		kmem_cache_free(proc_cache, proc);
 		return NULL;
 	}
     proc->p_filetable = ft_create();
     if (proc->p_filetable == NULL) {
         kfree(proc->p_name);
-        kfree(proc);
+        kmem_cache_free(proc_cache, proc);
         return NULL;
     }
 
-    proc->p_children = array_create();
-    if (proc->p_children == NULL) {
-        kfree(proc->p_filetable);
-        kfree(proc->p_name);
-        kfree(proc);
-        return NULL;
-    }
-
-	threadarray_init(&proc->p_threads);
-	spinlock_init(&proc->p_lock);
-
 	/* VM fields */
 	proc->p_addrspace = NULL;
 
@@ -136,10 +158,7 @@ proc_destroy(struct proc *proc)
 		proc->p_cwd = NULL;
 	}
     /* PID fields */
-    int children_size = array_num(proc->p_children);
-    for (int i = 0; i < children_size; i++) {
-        array_remove(proc->p_children, 0);
-    }
+    array_setsize(proc->p_children, 0);
 
 	/* VM fields */
 	if (proc->p_addrspace) {
@@ -191,17 +210,11 @@ proc_destroy(struct proc *proc)
 
     ft_destroy(proc->p_filetable);
 
-    int threadarray_size = threadarray_num(&proc->p_threads);
-    for (int i = 0; i < threadarray_size; i++) {
-        threadarray_remove(&proc->p_threads, 0);
-    }
-	threadarray_cleanup(&proc->p_threads);
-	spinlock_cleanup(&proc->p_lock);
-
-    array_destroy(proc->p_children);
+    /* the arrays and p_lock stay set up in the cache */
+    threadarray_setsize(&proc->p_threads, 0);
 
 	kfree(proc->p_name);
-	kfree(proc);
+	kmem_cache_free(proc_cache, proc);
 }
 
 /*
@@ -210,6 +223,15 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
+	ft_bootstrap();
+	fork_bootstrap();
+
+	proc_cache = kmem_cache_create("proc", sizeof(struct proc),
+				       proc_ctor, proc_dtor);
+	if (proc_cache == NULL) {
+		panic("proc_bootstrap: Out of memory\n");
+	}
+
 	kproc = proc_create("[kernel]");
 	if (kproc == NULL) {
 		panic("proc_create for kproc failed\n");
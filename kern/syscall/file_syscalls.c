@@ -36,18 +36,18 @@ int sys_open(const char *filename, int flags, int *retval){
     if(masked_flags != O_RDONLY && masked_flags != O_WRONLY && masked_flags != O_RDWR){
         return EINVAL;
     }
-    lock_acquire(ft->ft_lock);
+    rwlock_acquire_write(ft->ft_lock);
     // copy string from user space to kernel space
     err_copyinstr = copyinstr((const_userptr_t)filename, new_path, PATH_MAX, &got);
     if(err_copyinstr){
-        lock_release(ft->ft_lock);
+        rwlock_release_write(ft->ft_lock);
         return err_copyinstr;
     }
 
     // try to open file
     err_vfsopen = vfs_open(new_path, flags, 0, &new_file);
     if(err_vfsopen){
-        lock_release(ft->ft_lock);
+        rwlock_release_write(ft->ft_lock);
         return err_vfsopen;
     }
     
@@ -63,7 +63,7 @@ int sys_open(const char *filename, int flags, int *retval){
     }
     // no valid slot (too many files opened)
     if(entry_created == false){
-        lock_release(ft->ft_lock);
+        rwlock_release_write(ft->ft_lock);
         return EINVAL;
     }
     
@@ -74,7 +74,7 @@ int sys_open(const char *filename, int flags, int *retval){
     
     *retval = fd;
     lock_release(ft->ft_entries[fd]->entry_lock);
-    lock_release(ft->ft_lock);
+    rwlock_release_write(ft->ft_lock);
     return 0;
 
 }
@@ -87,35 +87,43 @@ ssize_t sys_read(int fd, void *buf, size_t buflen, int *retval){
 
     KASSERT(ft != NULL);
 
+    rwlock_acquire_read(ft->ft_lock);
+
     // check if ft and fd are valid
     if(fd < 0 || fd > OPEN_MAX - 1 || ft->ft_entries[fd] == NULL){
+        rwlock_release_read(ft->ft_lock);
         return EBADF;
     }
+    struct file_entry *entry = ft->ft_entries[fd];
 
     // check if flag is valid
-    int masked_flags = ft->ft_entries[fd]->rwflags & O_ACCMODE;
+    int masked_flags = entry->rwflags & O_ACCMODE;
     if(masked_flags != O_RDONLY && masked_flags != O_RDWR){
+        rwlock_release_read(ft->ft_lock);
         return EBADF;
     }
     
-    lock_acquire(ft->ft_entries[fd]->entry_lock);
+    // holding the entry keeps close from freeing it once the table is let go
+    lock_acquire(entry->entry_lock);
+    rwlock_release_read(ft->ft_lock);
+
     // create uio struct to get the working directory from virtual file system
-    uio_kinit(&iovec, &uio, (userptr_t)buf, buflen, ft->ft_entries[fd]->offset, UIO_READ);
+    uio_kinit(&iovec, &uio, (userptr_t)buf, buflen, entry->offset, UIO_READ);
     uio.uio_segflg = UIO_USERSPACE;
     uio.uio_space = curproc->p_addrspace;
 
     // use VOP_READ to read file
-    result = VOP_READ(ft->ft_entries[fd]->file, &uio);
+    result = VOP_READ(entry->file, &uio);
     if(result){
-        lock_release(ft->ft_entries[fd]->entry_lock);
+        lock_release(entry->entry_lock);
         return result;
     }
 
     // retval is the amount of data transfered
     off_t len = (off_t)buflen - uio.uio_resid;
-    ft->ft_entries[fd]->offset += len;
+    entry->offset += len;
     *retval = len;
-    lock_release(ft->ft_entries[fd]->entry_lock);
+    lock_release(entry->entry_lock);
     return 0;
 
 }
@@ -128,36 +136,43 @@ ssize_t sys_write(int fd, void *buf, size_t nbytes, int *retval){
     
     KASSERT(ft != NULL);
 
+    rwlock_acquire_read(ft->ft_lock);
+
     // check if ft and fd are valid
     if(fd < 0 || fd > OPEN_MAX - 1 || ft->ft_entries[fd] == NULL){
+        rwlock_release_read(ft->ft_lock);
         return EBADF;
     }
+    struct file_entry *entry = ft->ft_entries[fd];
 
     // check if flag is valid
-    int masked_flags = ft->ft_entries[fd]->rwflags & O_ACCMODE;
+    int masked_flags = entry->rwflags & O_ACCMODE;
     if(masked_flags != O_WRONLY && masked_flags != O_RDWR){
+        rwlock_release_read(ft->ft_lock);
         return EBADF;
     }
 
-    lock_acquire(ft->ft_entries[fd]->entry_lock);
+    // as in sys_read
+    lock_acquire(entry->entry_lock);
+    rwlock_release_read(ft->ft_lock);
     
     // create uio struct to get the working directory from virtual file system
-    uio_kinit(&iovec, &uio, buf, nbytes, ft->ft_entries[fd]->offset, UIO_WRITE);
+    uio_kinit(&iovec, &uio, buf, nbytes, entry->offset, UIO_WRITE);
     uio.uio_segflg = UIO_USERSPACE;
     uio.uio_space = curproc->p_addrspace;
     
     // use VOP_WRITE to write file
-    result = VOP_WRITE(ft->ft_entries[fd]->file, &uio);
+    result = VOP_WRITE(entry->file, &uio);
     if(result){
-        lock_release(ft->ft_entries[fd]->entry_lock);
+        lock_release(entry->entry_lock);
         return result;
     }
 
     // retval is the amount of data transfered
     off_t len = (off_t)nbytes - uio.uio_resid;
-    ft->ft_entries[fd]->offset += len;
+    entry->offset += len;
     *retval = len;
-    lock_release(ft->ft_entries[fd]->entry_lock);
+    lock_release(entry->entry_lock);
     return 0;
 
 }
@@ -174,11 +189,11 @@ off_t sys_lseek(int fd, off_t pos, int whence, int *retval_low, int *retval_high
         return EINVAL;
     }
 
-    lock_acquire(ft->ft_lock);
+    rwlock_acquire_read(ft->ft_lock);
 
     // check if ft and fd are valid
     if(fd < 0 || fd > OPEN_MAX - 1 || ft->ft_entries[fd] == NULL){
-        lock_release(ft->ft_lock);
+        rwlock_release_read(ft->ft_lock);
         return EBADF;
     }
 
@@ -188,14 +203,14 @@ off_t sys_lseek(int fd, off_t pos, int whence, int *retval_low, int *retval_high
 
     if(entry == NULL){
         lock_release(entry->entry_lock);
-        lock_release(ft->ft_lock);
+        rwlock_release_read(ft->ft_lock);
         return EBADF;
     }
 
     // check if seek is illegal
     if(!VOP_ISSEEKABLE(entry->file)){
         lock_release(entry->entry_lock);
-        lock_release(ft->ft_lock);
+        rwlock_release_read(ft->ft_lock);
         return ESPIPE;
     }
 
@@ -209,7 +224,7 @@ off_t sys_lseek(int fd, off_t pos, int whence, int *retval_low, int *retval_high
     }else if(whence == SEEK_END){
         if(err){
             lock_release(entry->entry_lock);
-            lock_release(ft->ft_lock);
+            rwlock_release_read(ft->ft_lock);
             return err;
         }
         seek_pos = statbuff.st_size + pos;
@@ -218,7 +233,7 @@ off_t sys_lseek(int fd, off_t pos, int whence, int *retval_low, int *retval_high
     // check if seek position is valid
     if(seek_pos < 0){
         lock_release(entry->entry_lock);
-        lock_release(ft->ft_lock);
+        rwlock_release_read(ft->ft_lock);
         return EINVAL;
     }
 
@@ -226,7 +241,7 @@ off_t sys_lseek(int fd, off_t pos, int whence, int *retval_low, int *retval_high
     *retval_low = seek_pos >> 32;
     *retval_high = seek_pos & 0xffffffff;
     lock_release(entry->entry_lock);
-    lock_release(ft->ft_lock);
+    rwlock_release_read(ft->ft_lock);
     
     return 0;
     
@@ -239,10 +254,10 @@ int sys_close(int fd)
 
     KASSERT(ft != NULL);
 
-    lock_acquire(ft->ft_lock);
+    rwlock_acquire_write(ft->ft_lock);
     
     if (fd < 0 || fd > OPEN_MAX || ft->ft_entries[fd] == NULL) {
-        lock_release(ft->ft_lock);
+        rwlock_release_write(ft->ft_lock);
         return EBADF;
     }
     // close entry if being used
@@ -256,7 +271,7 @@ int sys_close(int fd)
     }
     ft->ft_entries[fd] = NULL;
     
-    lock_release(ft->ft_lock);
+    rwlock_release_write(ft->ft_lock);
     return 0;
 }
 
@@ -266,13 +281,13 @@ int sys_dup2(int oldfd, int newfd, int *retval)
 
     KASSERT(ft != NULL);
 
-    lock_acquire(ft->ft_lock);
+    rwlock_acquire_write(ft->ft_lock);
 
     if (newfd < 0 || oldfd < 0 || 
         newfd >= OPEN_MAX || oldfd >= OPEN_MAX ||
         ft->ft_entries[oldfd] == NULL) {
 
-        lock_release(ft->ft_lock);
+        rwlock_release_write(ft->ft_lock);
         return EBADF;
     }
 
@@ -299,7 +314,7 @@ int sys_dup2(int oldfd, int newfd, int *retval)
     entry_incref(old_entry);
     lock_release(old_entry->entry_lock);
     
-    lock_release(ft->ft_lock);
+    rwlock_release_write(ft->ft_lock);
     *retval = newfd;
 
     return 0;
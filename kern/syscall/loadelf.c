@@ -59,6 +59,9 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include "opt-dumbvm.h"
+
+#if OPT_DUMBVM
 
 /*
  * Load a segment at virtual address VADDR. The segment in memory
@@ -145,6 +148,54 @@ load_segment(struct addrspace *as, struct vnode *v,
 	return result;
 }
 
+#else /* !OPT_DUMBVM */
+
+/*
+ * Load a segment at virtual address VADDR. The segment in memory
+ * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
+ * segment on disk is located at file offset OFFSET and has length
+ * FILESIZE.
+ *
+ * FILESIZE may be less than MEMSIZE; if so the remaining portion of
+ * the in-memory segment should be zero-filled.
+ *
+ * Nothing is read here. The segment is recorded as backed by the file
+ * and vm_fault reads each page in the first time it is touched, so
+ * pages of the program that never run are never read. Pages past
+ * FILESIZE are zero-filled on demand like any other fresh page.
+ *
+ * A segment with nothing to zero-fill (normally the text) is mapped
+ * from the file's page cache if it is read-only, so processes running
+ * the same program share its pages instead of each reading its own.
+ *
+ * as_define_region refuses regions outside user space, so there is no
+ * way for an executable to get its pages mapped into the kernel.
+ */
+static
+int
+load_segment(struct addrspace *as, struct vnode *v,
+	     off_t offset, vaddr_t vaddr,
+	     size_t memsize, size_t filesize,
+	     int is_executable)
+{
+	(void)is_executable;
+
+	if (filesize > memsize) {
+		kprintf("ELF: warning: segment filesize > segment memsize\n");
+		filesize = memsize;
+	}
+
+	DEBUG(DB_EXEC, "ELF: Mapping %lu bytes at 0x%lx\n",
+	      (unsigned long) filesize, (unsigned long) vaddr);
+
+	if (memsize == filesize) {
+		return as_share_file(as, v, offset, vaddr, filesize);
+	}
+	return as_map_file(as, v, offset, vaddr, filesize);
+}
+
+#endif /* OPT_DUMBVM */
+
 /*
  * Load an ELF executable user program into the current address space.
  *
@@ -27,6 +27,21 @@ int sys_getpid(int *retval)
     return 0;
 }
 
+// the parent's trapframe, copied for the child to start from
+static struct kmem_cache *fork_tf_cache;
+
+/*
+ * Set up the cache of fork trapframe copies
+ */
+void fork_bootstrap(void)
+{
+    fork_tf_cache = kmem_cache_create("fork trapframe",
+                                      sizeof(struct trapframe), NULL, NULL);
+    if (fork_tf_cache == NULL) {
+        panic("fork_bootstrap: Out of memory\n");
+    }
+}
+
 // used to make sure the forked processes trapframe is saved
 static void enter_usermode(void *data1, unsigned long data2) 
 {
@@ -34,7 +49,7 @@ static void enter_usermode(void *data1, unsigned long data2)
     void *tf = (void *) curthread->t_stack + 16;
 
 	memcpy(tf, (const void *) data1, sizeof(struct trapframe));
-	kfree((struct trapframe *) data1);
+	kmem_cache_free(fork_tf_cache, data1);
 
     as_activate();
     mips_usermode(tf);
@@ -76,7 +91,7 @@ int sys_fork(struct trapframe *tf, int *retval)
 
     // copy file_table of the current proc to the new proc
     struct file_table* ft = curproc->p_filetable;
-    lock_acquire(ft->ft_lock);
+    rwlock_acquire_read(ft->ft_lock);
     // increment the ref_count of all entries that aren't NULL
     for (int i = 0; i < OPEN_MAX; i++) {
         if(ft->ft_entries[i] != NULL) {
@@ -87,10 +102,17 @@ int sys_fork(struct trapframe *tf, int *retval)
     }
     // forked proc and current proc share a pointer to the same filetable
     new_proc->p_filetable = ft;
-    lock_release(ft->ft_lock);
+    rwlock_release_read(ft->ft_lock);
     
     // copy the trapframe of the current proc to the new proc
-    struct trapframe* fork_tf = kmalloc(sizeof(struct trapframe));
+    struct trapframe* fork_tf = kmem_cache_alloc(fork_tf_cache);
+    if (fork_tf == NULL) {
+        lock_acquire(pid_table->pt_lock);
+        pid_table_clear_pid(new_proc->pid);
+        lock_release(pid_table->pt_lock);
+        proc_destroy(new_proc);
+        return ENOMEM;
+    }
     memcpy(fork_tf, tf, sizeof(struct trapframe));
     // modify values so that the forked process can return properly
     fork_tf->tf_v0 = 0;
@@ -105,7 +127,7 @@ int sys_fork(struct trapframe *tf, int *retval)
         pid_table_clear_pid(new_proc->pid);
         lock_release(pid_table->pt_lock);
         proc_destroy(new_proc);
-        kfree(fork_tf);
+        kmem_cache_free(fork_tf_cache, fork_tf);
         return err;
     }
 
@@ -200,6 +222,10 @@ int sys_execv(const char *program, char **args)
 		vfs_close(v);
 		return ENOMEM;
 	}
+#if !OPT_DUMBVM
+    // the stack limit carries over to the new program
+    as->as_stacklimit = proc_getas()->as_stacklimit;
+#endif
 
     // Switch to it and activate it. 
 	oldas = proc_setas(as);
@@ -336,8 +362,11 @@ void sys__exit(int waitcode)
         pid_table->pt_status[curproc->pid] = ZOMBIE;
         pid_table->pt_waitcode[curproc->pid] = waitcode;
     } else if (pid_table->pt_status[curproc->pid] == ORPHAN) {
-        proc_destroy(curproc);
-        pid_table_clear_pid(curproc->pid);
+        // nobody will wait for us; leave the proc before it is reused
+        struct proc *proc = curproc;
+        pid_table_clear_pid(proc->pid);
+        proc_remthread(curthread);
+        proc_destroy(proc);
     } else {
         panic("Tried to remove a dead/ready process. \n");
     }
@@ -0,0 +1,228 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <kern/vmstat.h>
+#include <stat.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <filetable.h>
+#include <vnode.h>
+#include <syscall.h>
+
+int sys_sbrk(intptr_t amount, int *retval)
+{
+    struct addrspace *as = proc_getas();
+    vaddr_t oldbreak, newbreak;
+    int err;
+
+    KASSERT(as != NULL && as->as_heap != NULL);
+
+    // the break only ever moves by whole pages
+    if ((amount & ~(intptr_t)PAGE_FRAME) != 0) {
+        return EINVAL;
+    }
+
+    oldbreak = as->as_heap->rg_vbase + as->as_heap->rg_npages * PAGE_SIZE;
+    newbreak = oldbreak + amount;
+
+    // catch wraparound in either direction
+    if ((amount > 0 && newbreak < oldbreak) ||
+        (amount < 0 && newbreak > oldbreak)) {
+        return amount > 0 ? ENOMEM : EINVAL;
+    }
+
+    err = as_set_break(as, newbreak);
+    if (err) {
+        return err;
+    }
+
+    *retval = (int) oldbreak;
+    return 0;
+}
+
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+             off_t offset, int *retval)
+{
+    struct addrspace *as = proc_getas();
+    struct file_table *ft = curproc->p_filetable;
+    struct vnode *v;
+    mode_t type;
+    vaddr_t vaddr;
+    int perms = 0;
+    int err;
+
+    // addr is only a hint, and we never take it
+    (void) addr;
+
+    if (len == 0 || len > USERSPACETOP) {
+        return EINVAL;
+    }
+    if (offset < 0 || offset % PAGE_SIZE != 0) {
+        return EINVAL;
+    }
+    if (flags != MAP_SHARED && flags != MAP_PRIVATE) {
+        return EINVAL;
+    }
+    if ((prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) != 0) {
+        return EINVAL;
+    }
+
+    // pages are only ever read from the file, never written back
+    if (flags == MAP_SHARED && (prot & PROT_WRITE)) {
+        return ENOTSUP;
+    }
+
+    // take our own reference so a close can't drop the vnode under us
+    rwlock_acquire_read(ft->ft_lock);
+    if (fd < 0 || fd > OPEN_MAX - 1 || ft->ft_entries[fd] == NULL) {
+        rwlock_release_read(ft->ft_lock);
+        return EBADF;
+    }
+    if ((ft->ft_entries[fd]->rwflags & O_ACCMODE) == O_WRONLY) {
+        rwlock_release_read(ft->ft_lock);
+        return EACCES;
+    }
+    v = ft->ft_entries[fd]->file;
+    VOP_INCREF(v);
+    rwlock_release_read(ft->ft_lock);
+
+    err = VOP_GETTYPE(v, &type);
+    if (err) {
+        VOP_DECREF(v);
+        return err;
+    }
+    if (type != S_IFREG) {
+        VOP_DECREF(v);
+        return ENODEV;
+    }
+
+    if (prot & PROT_READ) {
+        perms |= RG_R;
+    }
+    if (prot & PROT_WRITE) {
+        perms |= RG_W;
+    }
+    if (prot & PROT_EXEC) {
+        perms |= RG_X;
+    }
+
+    // as_mmap takes the region's own reference
+    err = as_mmap(as, v, offset, (len + PAGE_SIZE - 1) / PAGE_SIZE, perms,
+                  &vaddr);
+    VOP_DECREF(v);
+    if (err) {
+        return err;
+    }
+
+    *retval = (int) vaddr;
+    return 0;
+}
+
+int sys_munmap(userptr_t addr, size_t len)
+{
+    vaddr_t vaddr = (vaddr_t) addr;
+
+    if (len == 0 || (vaddr & ~(vaddr_t)PAGE_FRAME) != 0) {
+        return EINVAL;
+    }
+
+    return as_munmap(proc_getas(), vaddr, (len + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+// The advice sets how far each region in the range may fault ahead;
+// the window still adapts within that.
+int sys_madvise(userptr_t addr, size_t len, int advice)
+{
+    struct addrspace *as = proc_getas();
+    vaddr_t vaddr = (vaddr_t) addr;
+    vaddr_t end = vaddr + len;
+    struct region *rg;
+    unsigned npages;
+    int err;
+
+    if (len == 0 || (vaddr & ~(vaddr_t)PAGE_FRAME) != 0 || end < vaddr) {
+        return EINVAL;
+    }
+
+    switch (advice) {
+        case MADV_NORMAL:
+        npages = VM_FAULTAROUND_MAX;
+        break;
+
+        case MADV_RANDOM:
+        npages = 0;
+        break;
+
+        default:
+        return EINVAL;
+    }
+
+    // every page in the range must be mapped
+    while (vaddr < end) {
+        rg = as_find_region(as, vaddr);
+        if (rg == NULL) {
+            return ENOMEM;
+        }
+        err = as_set_faultaround(as, vaddr, npages);
+        if (err) {
+            return err;
+        }
+        vaddr = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+    }
+
+    return 0;
+}
+
+int sys_vmstat(userptr_t buf)
+{
+    struct addrspace *as = proc_getas();
+    struct vmstat vs;
+
+    vmstat_get(&vs);
+    vs.vms_tlbmisses = as->as_tlbmisses;
+    vs.vms_tlbevictions = as->as_tlbevictions;
+    vs.vms_faultaround = as->as_prefetched;
+    return copyout(&vs, buf, sizeof(vs));
+}
+
+// Only the stack size can be limited. The limit is kept in pages and
+// has no separate hard limit.
+int sys_getrlimit(int resource, userptr_t rlp)
+{
+    struct addrspace *as = proc_getas();
+    struct rlimit rl;
+
+    if (resource != RLIMIT_STACK) {
+        return EINVAL;
+    }
+
+    rl.rlim_cur = as->as_stacklimit * PAGE_SIZE;
+    rl.rlim_max = RLIM_INFINITY;
+    return copyout(&rl, rlp, sizeof(rl));
+}
+
+int sys_setrlimit(int resource, const_userptr_t rlp)
+{
+    struct addrspace *as = proc_getas();
+    struct rlimit rl;
+    int err;
+
+    if (resource != RLIMIT_STACK) {
+        return EINVAL;
+    }
+    err = copyin(rlp, &rl, sizeof(rl));
+    if (err) {
+        return err;
+    }
+    if (rl.rlim_cur > rl.rlim_max || rl.rlim_cur > USERSTACK) {
+        return EINVAL;
+    }
+
+    return as_set_stacklimit(as, (rl.rlim_cur + PAGE_SIZE - 1) / PAGE_SIZE);
+}
@@ -32,6 +32,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
@@ -399,3 +400,159 @@ cvtest2(int nargs, char **args)
 	kprintf("cvtest2 done\n");
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+/*
+ * Reader-writer lock throughput.
+ *
+ * A growing number of readers hammer one rwlock while a writer
+ * updates it now and then; we time how long the readers take. Each
+ * round is run with an ordinary rwlock and with a per-cpu one. With
+ * more cpus, reads should scale, and scale better per-cpu.
+ */
+
+#define RWT_READS      2000	/* read holds per reader */
+#define RWT_WRITES     20	/* write holds per round */
+#define RWT_HOLD       20	/* busy-loop while holding the lock */
+#define RWT_MAXREADERS 16
+
+static struct rwlock *rwt_lock;
+static struct semaphore *rwt_gate;
+static volatile bool rwt_failed;
+
+static
+void
+rwtreader(void *junk, unsigned long num)
+{
+	unsigned long v1, v2;
+	volatile int j;
+	int i;
+
+	(void)junk;
+
+	P(rwt_gate);
+	for (i=0; i<RWT_READS; i++) {
+		rwlock_acquire_read(rwt_lock);
+		v1 = testval1;
+		for (j=0; j<RWT_HOLD; j++);
+		v2 = testval2;
+		rwlock_release_read(rwt_lock);
+
+		if (v2 != v1*v1 && !rwt_failed) {
+			rwt_failed = true;
+			kprintf("reader %lu: writer ran while reading\n", num);
+		}
+	}
+	V(donesem);
+}
+
+static
+void
+rwtwriter(void *junk, unsigned long num)
+{
+	volatile int j;
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	P(rwt_gate);
+	for (i=0; i<RWT_WRITES; i++) {
+		rwlock_acquire_write(rwt_lock);
+		testval1++;
+		for (j=0; j<RWT_HOLD; j++);
+		testval2 = testval1*testval1;
+		rwlock_release_write(rwt_lock);
+
+		/* Give the readers plenty of time in between. */
+		for (j=0; j<1000*RWT_HOLD; j++);
+	}
+	V(donesem);
+}
+
+/*
+ * Run one round with NREADERS readers; returns elapsed milliseconds.
+ */
+static
+unsigned
+rwtround(unsigned nreaders)
+{
+	struct timespec ts1, ts2;
+	unsigned i;
+	int result;
+
+	for (i=0; i<nreaders; i++) {
+		result = thread_fork("rwtest", NULL, rwtreader, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	result = thread_fork("rwtest", NULL, rwtwriter, NULL, 0);
+	if (result) {
+		panic("rwtest: thread_fork failed: %s\n", strerror(result));
+	}
+
+	gettime(&ts1);
+	for (i=0; i<nreaders+1; i++) {
+		V(rwt_gate);
+	}
+	for (i=0; i<nreaders+1; i++) {
+		P(donesem);
+	}
+	gettime(&ts2);
+
+	timespec_sub(&ts2, &ts1, &ts2);
+	return ts2.tv_sec*1000 + ts2.tv_nsec/1000000;
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	unsigned maxreaders, nreaders, ms, percpu;
+
+	maxreaders = RWT_MAXREADERS;
+	if (nargs > 1) {
+		maxreaders = atoi(args[1]);
+		if (maxreaders == 0) {
+			kprintf("Usage: sy5 [maxreaders]\n");
+			return EINVAL;
+		}
+	}
+
+	inititems();
+	rwt_gate = sem_create("rwt_gate", 0);
+	if (rwt_gate == NULL) {
+		panic("rwtest: sem_create failed\n");
+	}
+	rwt_failed = false;
+	testval1 = testval2 = 0;
+
+	kprintf("Starting rwlock throughput test...\n");
+	for (percpu = 0; percpu < 2; percpu++) {
+		rwt_lock = percpu ? rwlock_create_percpu("rwt_lock") :
+			rwlock_create("rwt_lock");
+		if (rwt_lock == NULL) {
+			panic("rwtest: rwlock_create failed\n");
+		}
+		kprintf("%s rwlock:\n", percpu ? "Per-cpu" : "Plain");
+		for (nreaders = 1; nreaders <= maxreaders; nreaders *= 2) {
+			ms = rwtround(nreaders);
+			kprintf("  %2u readers: %6u reads in %5u ms",
+				nreaders, nreaders * RWT_READS, ms);
+			if (ms > 0) {
+				kprintf(", %u reads/ms",
+					nreaders * RWT_READS / ms);
+			}
+			kprintf("\n");
+		}
+		rwlock_destroy(rwt_lock);
+		rwt_lock = NULL;
+	}
+	sem_destroy(rwt_gate);
+	rwt_gate = NULL;
+
+	kprintf("Rwlock test %s\n", rwt_failed ? "failed" : "done");
+	return 0;
+}
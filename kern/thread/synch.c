@@ -33,9 +33,12 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <cpu.h>
+#include <platform/maxcpus.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
@@ -138,33 +141,57 @@ V(struct semaphore *sem)
 //
 // Lock.
 
+/*
+ * Locks come from an object cache, so a freed lock keeps its wait
+ * channel and spinlock for the next lock_create.
+ */
+static struct kmem_cache *lock_cache;
+
+static
+int
+lock_ctor(void *obj)
+{
+	struct lock *lock = obj;
+
+	lock->lk_wchan = wchan_create("lock");
+	if (lock->lk_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&lock->lk_lock);
+	lock->lk_holder = NULL;
+	lock->lk_spins = 0;
+	lock->lk_blocks = 0;
+	return 0;
+}
+
+static
+void
+lock_dtor(void *obj)
+{
+	struct lock *lock = obj;
+
+	spinlock_cleanup(&lock->lk_lock);
+	wchan_destroy(lock->lk_wchan);
+}
+
 struct lock *
 lock_create(const char *name)
 {
     struct lock *lock;
 
-    lock = kmalloc(sizeof(struct lock));
+    lock = kmem_cache_alloc(lock_cache);
     if (lock == NULL) {
             return NULL;
     }
 
     lock->lk_name = kstrdup(name);
     if (lock->lk_name == NULL) {
-            kfree(lock);
+            kmem_cache_free(lock_cache, lock);
             return NULL;
     }
+    wchan_setname(lock->lk_wchan, lock->lk_name);
 
-    // add stuff here as needed
-    lock->lk_wchan = wchan_create(lock->lk_name);
-	if (lock->lk_wchan == NULL) {
-		kfree(lock->lk_name);
-		kfree(lock);
-		return NULL;
-	}
-	spinlock_init(&lock->lk_lock);
-	lock->lk_holder = NULL;
-
-        return lock;
+    return lock;
 }
 
 void
@@ -172,33 +199,101 @@ lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
 
-        // add stuff here as needed
         KASSERT(lock->lk_holder == NULL);
-        spinlock_cleanup(&lock->lk_lock);
-        wchan_destroy(lock->lk_wchan);
+        if (lock->lk_spins > 0 || lock->lk_blocks > 0) {
+                DEBUG(DB_THREADS, "lock %s: %u spins, %u blocks\n",
+                      lock->lk_name, lock->lk_spins, lock->lk_blocks);
+        }
+        lock->lk_spins = 0;
+        lock->lk_blocks = 0;
+        wchan_setname(lock->lk_wchan, "lock");
 
         kfree(lock->lk_name);
-        kfree(lock);
+        kmem_cache_free(lock_cache, lock);
+}
+
+/*
+ * How long lock_acquire spins on a running holder before giving up
+ * and sleeping, in polls of lk_holder; and how often it stops to
+ * check the holder is still running.
+ */
+#define LOCK_SPIN_MAX		4096
+#define LOCK_SPIN_CHECK		64
+
+/*
+ * True if HOLDER is running on some cpu right now. Call with the
+ * lock's spinlock held, which keeps HOLDER from releasing the lock
+ * and going away while we look at it.
+ */
+static
+bool
+lock_holder_running(struct thread *holder)
+{
+	return holder->t_state == S_RUN &&
+		holder->t_cpu->c_curthread == holder;
 }
 
 void
 lock_acquire(struct lock *lock)
 {
     // Write this
+    struct thread *holder;
+    unsigned spun, i;
+    bool slept;
+
     DEBUGASSERT(lock != NULL);
     KASSERT(curthread->t_in_interrupt == false);
 
+	spun = 0;
+	slept = false;
 	spinlock_acquire(&lock->lk_lock);
 	KASSERT(lock->lk_holder != curthread);
-	while (lock->lk_holder != NULL) {
+	while ((holder = lock->lk_holder) != NULL) {
+		if (spun < LOCK_SPIN_MAX && lock_holder_running(holder)) {
+			/*
+			 * Poll without the spinlock so the holder can
+			 * release. Only lk_holder may be looked at
+			 * here; HOLDER could exit once it lets go.
+			 */
+			spinlock_release(&lock->lk_lock);
+			for (i=0; i<LOCK_SPIN_CHECK &&
+				     lock->lk_holder == holder; i++) {
+				/* nothing */
+			}
+			spun += LOCK_SPIN_CHECK;
+			spinlock_acquire(&lock->lk_lock);
+			continue;
+		}
 		/* As in the semaphore. */
+		lock->lk_blocks++;
+		slept = true;
         wchan_sleep(lock->lk_wchan, &lock->lk_lock);
 	}
 
+	if (spun > 0 && !slept) {
+		lock->lk_spins++;
+	}
 	lock->lk_holder = curthread;
 	spinlock_release(&lock->lk_lock);
 }
 
+bool
+lock_tryacquire(struct lock *lock)
+{
+    bool got;
+
+    DEBUGASSERT(lock != NULL);
+
+	spinlock_acquire(&lock->lk_lock);
+	got = (lock->lk_holder == NULL);
+	if (got) {
+		lock->lk_holder = curthread;
+	}
+	spinlock_release(&lock->lk_lock);
+
+    return got;
+}
+
 void
 lock_release(struct lock *lock)
 {
@@ -232,31 +327,50 @@ lock_do_i_hold(struct lock *lock)
 // CV
 
 
+/* CVs are cached the same way. */
+static struct kmem_cache *cv_cache;
+
+static
+int
+cv_ctor(void *obj)
+{
+	struct cv *cv = obj;
+
+	cv->cv_wchan = wchan_create("cv");
+	if (cv->cv_wchan == NULL) {
+		return ENOMEM;
+	}
+	spinlock_init(&cv->cv_wchanlock);
+	return 0;
+}
+
+static
+void
+cv_dtor(void *obj)
+{
+	struct cv *cv = obj;
+
+	spinlock_cleanup(&cv->cv_wchanlock);
+	wchan_destroy(cv->cv_wchan);
+}
+
 struct cv *
 cv_create(const char *name)
 {
         struct cv *cv;
 
-        cv = kmalloc(sizeof(struct cv));
+        cv = kmem_cache_alloc(cv_cache);
         if (cv == NULL) {
                 return NULL;
         }
 
         cv->cv_name = kstrdup(name);
         if (cv->cv_name==NULL) {
-                kfree(cv);
+                kmem_cache_free(cv_cache, cv);
                 return NULL;
         }
+        wchan_setname(cv->cv_wchan, cv->cv_name);
 
-        // add stuff here as needed
-        cv->cv_wchan = wchan_create(cv->cv_name);
-	if (cv->cv_wchan == NULL) {
-		kfree(cv->cv_name);
-		kfree(cv);
-		return NULL;
-	}
-
-	spinlock_init(&cv->cv_wchanlock);
         return cv;
 }
 
@@ -265,12 +379,10 @@ cv_destroy(struct cv *cv)
 {
         KASSERT(cv != NULL);
 
-        // add stuff here as needed
-        spinlock_cleanup(&cv->cv_wchanlock);
-	wchan_destroy(cv->cv_wchan);
+        wchan_setname(cv->cv_wchan, "cv");
 
         kfree(cv->cv_name);
-        kfree(cv);
+        kmem_cache_free(cv_cache, cv);
 }
 
 void
@@ -312,3 +424,268 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 	wchan_wakeall(cv->cv_wchan, &cv->cv_wchanlock);
 	spinlock_release(&cv->cv_wchanlock);
 }
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock.
+
+/*
+ * One cpu's count of readers, for locks made by rwlock_create_percpu.
+ * A reader that migrates while holding the lock is counted up on one
+ * cpu and down on another, so individual counts can go negative; only
+ * the sum means anything. A count's spinlock also keeps the reader
+ * from migrating while it looks at rw_writers.
+ */
+struct rwlock_cpu {
+	struct spinlock rc_lock;
+	volatile int rc_readers;
+};
+
+static
+struct rwlock *
+rwlock_create_common(const char *name, bool percpu)
+{
+	struct rwlock *rw;
+	unsigned i;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+	rw->rwlock_name = kstrdup(name);
+	if (rw->rwlock_name == NULL) {
+		goto fail_rw;
+	}
+	rw->rw_readwchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_readwchan == NULL) {
+		goto fail_name;
+	}
+	rw->rw_writewchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_writewchan == NULL) {
+		goto fail_readwchan;
+	}
+	rw->rw_cpus = NULL;
+	if (percpu) {
+		rw->rw_cpus = kmalloc(MAXCPUS * sizeof(rw->rw_cpus[0]));
+		if (rw->rw_cpus == NULL) {
+			goto fail_writewchan;
+		}
+		for (i=0; i<MAXCPUS; i++) {
+			spinlock_init(&rw->rw_cpus[i].rc_lock);
+			rw->rw_cpus[i].rc_readers = 0;
+		}
+	}
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_writers = 0;
+	rw->rw_writer = NULL;
+	return rw;
+
+ fail_writewchan:
+	wchan_destroy(rw->rw_writewchan);
+ fail_readwchan:
+	wchan_destroy(rw->rw_readwchan);
+ fail_name:
+	kfree(rw->rwlock_name);
+ fail_rw:
+	kfree(rw);
+	return NULL;
+}
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	return rwlock_create_common(name, false);
+}
+
+struct rwlock *
+rwlock_create_percpu(const char *name)
+{
+	return rwlock_create_common(name, true);
+}
+
+/*
+ * Total readers holding the lock. Call with rw_lock held; for a
+ * per-cpu lock this takes each cpu's count lock in turn.
+ */
+static
+int
+rwlock_readers(struct rwlock *rw)
+{
+	struct rwlock_cpu *rc;
+	int total;
+	unsigned i;
+
+	KASSERT(spinlock_do_i_hold(&rw->rw_lock));
+
+	total = rw->rw_readers;
+	if (rw->rw_cpus != NULL) {
+		for (i=0; i<MAXCPUS; i++) {
+			rc = &rw->rw_cpus[i];
+			spinlock_acquire(&rc->rc_lock);
+			total += rc->rc_readers;
+			spinlock_release(&rc->rc_lock);
+		}
+	}
+	KASSERT(total >= 0);
+	return total;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	unsigned i;
+
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_writers == 0);
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rwlock_readers(rw) == 0);
+	spinlock_release(&rw->rw_lock);
+
+	if (rw->rw_cpus != NULL) {
+		for (i=0; i<MAXCPUS; i++) {
+			spinlock_cleanup(&rw->rw_cpus[i].rc_lock);
+		}
+		kfree(rw->rw_cpus);
+	}
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_writewchan);
+	wchan_destroy(rw->rw_readwchan);
+	kfree(rw->rwlock_name);
+	kfree(rw);
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	struct rwlock_cpu *rc;
+
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	if (rw->rw_cpus != NULL) {
+		/*
+		 * With no writer about, just count ourselves on this
+		 * cpu. A writer sets rw_writers before it looks at the
+		 * counts, and looks at ours under rc_lock, so either
+		 * it sees our count or we see it.
+		 */
+		rc = &rw->rw_cpus[curcpu->c_number];
+		spinlock_acquire(&rc->rc_lock);
+		if (rw->rw_writers == 0) {
+			rc->rc_readers++;
+			spinlock_release(&rc->rc_lock);
+			return;
+		}
+		spinlock_release(&rc->rc_lock);
+	}
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+	while (rw->rw_writers > 0) {
+		wchan_sleep(rw->rw_readwchan, &rw->rw_lock);
+	}
+	if (rw->rw_cpus != NULL) {
+		rc = &rw->rw_cpus[curcpu->c_number];
+		spinlock_acquire(&rc->rc_lock);
+		rc->rc_readers++;
+		spinlock_release(&rc->rc_lock);
+	}
+	else {
+		rw->rw_readers++;
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	struct rwlock_cpu *rc;
+	bool writers;
+
+	DEBUGASSERT(rw != NULL);
+
+	if (rw->rw_cpus != NULL) {
+		/*
+		 * Count down on whatever cpu we are on now; only the
+		 * total matters. If a writer is waiting, it needs to
+		 * look at the total again.
+		 */
+		rc = &rw->rw_cpus[curcpu->c_number];
+		spinlock_acquire(&rc->rc_lock);
+		rc->rc_readers--;
+		writers = rw->rw_writers > 0;
+		spinlock_release(&rc->rc_lock);
+		if (writers) {
+			spinlock_acquire(&rw->rw_lock);
+			wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+			spinlock_release(&rw->rw_lock);
+		}
+		return;
+	}
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0 && rw->rw_writers > 0) {
+		wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+	/* From here on, new readers wait for us. */
+	rw->rw_writers++;
+	while (rw->rw_writer != NULL || rwlock_readers(rw) > 0) {
+		wchan_sleep(rw->rw_writewchan, &rw->rw_lock);
+	}
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	DEBUGASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	KASSERT(rw->rw_writers > 0);
+	rw->rw_writer = NULL;
+	rw->rw_writers--;
+	if (rw->rw_writers > 0) {
+		/* Writers first; the readers get their turn after. */
+		wchan_wakeone(rw->rw_writewchan, &rw->rw_lock);
+	}
+	else {
+		wchan_wakeall(rw->rw_readwchan, &rw->rw_lock);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Setup
+
+/*
+ * Set up the object caches for locks and CVs. Called early in boot,
+ * before anything creates either.
+ */
+void
+synch_bootstrap(void)
+{
+	lock_cache = kmem_cache_create("lock", sizeof(struct lock),
+				       lock_ctor, lock_dtor);
+	cv_cache = kmem_cache_create("cv", sizeof(struct cv),
+				     cv_ctor, cv_dtor);
+	if (lock_cache == NULL || cv_cache == NULL) {
+		panic("synch_bootstrap: Out of memory\n");
+	}
+}
@@ -115,6 +115,34 @@ thread_checkstack(struct thread *thread)
 	}
 }
 
+/*
+ * Threads come from an object cache that keeps each one's stack, so
+ * forking a thread doesn't have to allocate one.
+ */
+static struct kmem_cache *thread_cache;
+
+static
+int
+thread_ctor(void *obj)
+{
+	struct thread *thread = obj;
+
+	thread->t_stack = kmalloc(STACK_SIZE);
+	if (thread->t_stack == NULL) {
+		return ENOMEM;
+	}
+	return 0;
+}
+
+static
+void
+thread_dtor(void *obj)
+{
+	struct thread *thread = obj;
+
+	kfree(thread->t_stack);
+}
+
 /*
  * Create a thread. This is used both to create a first thread
  * for each CPU and to create subsequent forked threads.
@@ -127,14 +155,14 @@ thread_create(const char *name)
 
 	DEBUGASSERT(name != NULL);
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
 
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
+		kmem_cache_free(thread_cache, thread);
 		return NULL;
 	}
 	thread->t_wchan_name = "NEW";
@@ -143,10 +171,13 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_priority = 0;
+	thread->t_ticks = 0;
+	thread->t_lastrun = 0;
+	thread->t_migrations = 0;
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -172,6 +203,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -184,10 +216,16 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	c->c_schedules = 0;
 	c->c_spinlocks = 0;
+	c->c_exited = 0;
+	c->c_exitmigrations = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<CPU_NPRIORITIES; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
@@ -211,18 +249,17 @@ cpu_create(unsigned hardware_number)
 
 	if (c->c_number == 0) {
 		/*
-		 * Leave c->c_curthread->t_stack NULL for the boot
+		 * Set c->c_curthread->t_stack NULL for the boot
 		 * cpu. This means we're using the boot stack, which
 		 * can't be freed. (Exercise: what would it take to
-		 * make it possible to free the boot stack?)
+		 * make it possible to free the boot stack?) The
+		 * boot thread never exits, so it never goes back to
+		 * thread_cache without a stack.
 		 */
-		/*c->c_curthread->t_stack = ... */
+		kfree(c->c_curthread->t_stack);
+		c->c_curthread->t_stack = NULL;
 	}
 	else {
-		c->c_curthread->t_stack = kmalloc(STACK_SIZE);
-		if (c->c_curthread->t_stack == NULL) {
-			panic("cpu_create: couldn't allocate stack");
-		}
 		thread_checkstack_init(c->c_curthread);
 	}
 	c->c_curthread->t_cpu = c;
@@ -232,6 +269,19 @@ cpu_create(unsigned hardware_number)
 	return c;
 }
 
+/*
+ * Look up a CPU by number. CPUs are only ever added, during boot, so
+ * no locking is needed.
+ */
+struct cpu *
+cpu_bynumber(unsigned num)
+{
+	if (num >= cpuarray_num(&allcpus)) {
+		return NULL;
+	}
+	return cpuarray_get(&allcpus, num);
+}
+
 /*
  * Destroy a thread.
  *
@@ -254,9 +304,7 @@ thread_destroy(struct thread *thread)
 
 	/* Thread subsystem fields */
 	KASSERT(thread->t_proc == NULL);
-	if (thread->t_stack != NULL) {
-		kfree(thread->t_stack);
-	}
+	KASSERT(thread->t_stack != NULL);
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
@@ -264,7 +312,7 @@ thread_destroy(struct thread *thread)
 	thread->t_wchan_name = "DESTROYED";
 
 	kfree(thread->t_name);
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
 }
 
 /*
@@ -282,6 +330,8 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
+		curcpu->c_exited++;
+		curcpu->c_exitmigrations += z->t_migrations;
 		thread_destroy(z);
 	}
 }
@@ -294,6 +344,9 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	struct threadlist *rq;
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -308,9 +361,13 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = &curcpu->c_runqueue.tl_tail;
-	curcpu->c_runqueue.tl_tail.tln_prev = &curcpu->c_runqueue.tl_head;
+	for (i=0; i<CPU_NPRIORITIES; i++) {
+		rq = &curcpu->c_runqueue[i];
+		rq->tl_count = 0;
+		rq->tl_head.tln_next = &rq->tl_tail;
+		rq->tl_tail.tln_prev = &rq->tl_head;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -356,6 +413,12 @@ thread_bootstrap(void)
 
 	cpuarray_init(&allcpus);
 
+	thread_cache = kmem_cache_create("thread", sizeof(struct thread),
+					 thread_ctor, thread_dtor);
+	if (thread_cache == NULL) {
+		panic("thread_bootstrap: Out of memory\n");
+	}
+
 	/*
 	 * Create the cpu structure for the bootup CPU, the one we're
 	 * currently running on. Assume the hardware number is 0; that
@@ -440,6 +503,255 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Put T on the run queue for its priority on C. Call with C's run
+ * queue lock held.
+ */
+static
+void
+runqueue_add(struct cpu *c, struct thread *t)
+{
+	KASSERT(t->t_priority < CPU_NPRIORITIES);
+	threadlist_addtail(&c->c_runqueue[t->t_priority], t);
+	c->c_runcount++;
+}
+
+/*
+ * Take the thread that should run next off C's run queues, or NULL if
+ * there is none. Call with C's run queue lock held.
+ */
+static
+struct thread *
+runqueue_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=0; i<CPU_NPRIORITIES; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * A thread is cache-hot if it ran on its cpu within the last
+ * SCHED_HOT_HARDCLOCKS, so its working set is probably still in that
+ * cpu's cache. When choosing where to wake a thread up, a hot cache
+ * is worth as much as SCHED_AFFINITY fewer threads ahead of it.
+ */
+#define SCHED_HOT_HARDCLOCKS	2
+#define SCHED_AFFINITY		2
+
+static
+bool
+thread_is_hot(struct thread *t)
+{
+	return t->t_cpu->c_hardclocks - t->t_lastrun < SCHED_HOT_HARDCLOCKS;
+}
+
+/*
+ * Move T, which is not running or queued, to cpu C. Its cache there
+ * is cold, and t_lastrun counts in C's hardclocks from now on.
+ */
+static
+void
+thread_setcpu(struct thread *t, struct cpu *c)
+{
+	t->t_cpu = c;
+	t->t_lastrun = c->c_hardclocks - SCHED_HOT_HARDCLOCKS;
+	t->t_migrations++;
+}
+
+/*
+ * Move up to N ready threads from VICTIM's run queues to the current
+ * cpu's, taking the lowest priority ones first. Unless TAKEHOT is
+ * set, cache-hot threads are left alone. Returns how many were moved.
+ *
+ * Call without holding any run queue lock; only one is held at a
+ * time, so cpus can steal from each other without deadlock.
+ */
+static
+unsigned
+thread_steal(struct cpu *victim, unsigned n, bool takehot)
+{
+	struct threadlist stolen, *rq;
+	struct thread *t, *prev;
+	unsigned i;
+
+	KASSERT(victim != curcpu->c_self);
+
+	threadlist_init(&stolen);
+
+	spinlock_acquire(&victim->c_runqueue_lock);
+	for (i=CPU_NPRIORITIES; i-- > 0 && stolen.tl_count < n; ) {
+		rq = &victim->c_runqueue[i];
+		for (t = rq->tl_tail.tln_prev->tln_self;
+		     t != NULL && stolen.tl_count < n; t = prev) {
+			prev = t->t_listnode.tln_prev->tln_self;
+			/*
+			 * Ordinarily, a cpu's curthread will not
+			 * appear on its run queue. However, it can
+			 * under the following circumstances:
+			 *   - it went to sleep;
+			 *   - the processor became idle, so it
+			 *     remained curthread;
+			 *   - it was reawakened, so it was put on the
+			 *     run queue;
+			 *   - and the processor hasn't fully unidled
+			 *     yet, so all these things are still true.
+			 *
+			 * Migrating it then can cause bad things to
+			 * happen, so leave it where it is.
+			 */
+			if (t == victim->c_curthread) {
+				continue;
+			}
+			if (!takehot && thread_is_hot(t)) {
+				continue;
+			}
+			threadlist_remove(rq, t);
+			victim->c_runcount--;
+			threadlist_addhead(&stolen, t);
+		}
+	}
+	spinlock_release(&victim->c_runqueue_lock);
+
+	n = stolen.tl_count;
+	if (n > 0) {
+		spinlock_acquire(&curcpu->c_runqueue_lock);
+		while ((t = threadlist_remhead(&stolen)) != NULL) {
+			thread_setcpu(t, curcpu->c_self);
+			runqueue_add(curcpu->c_self, t);
+		}
+		spinlock_release(&curcpu->c_runqueue_lock);
+		DEBUG(DB_THREADS, "Stole %u threads: cpu %u -> %u\n",
+		      n, victim->c_number, curcpu->c_number);
+	}
+	threadlist_cleanup(&stolen);
+	return n;
+}
+
+/*
+ * Find the cpu other than this one with the most threads waiting to
+ * run, going by the unlocked estimates, and how many that is. Returns
+ * NULL if none has any.
+ */
+static
+struct cpu *
+thread_busiest(unsigned *count_ret)
+{
+	struct cpu *c, *busiest;
+	unsigned i, numcpus, count, most;
+
+	busiest = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		count = c->c_runcount;
+		if (c != curcpu->c_self && count > most) {
+			busiest = c;
+			most = count;
+		}
+	}
+	*count_ret = most;
+	return busiest;
+}
+
+/*
+ * Called by an idle cpu: take half the waiting threads of the
+ * busiest other cpu. Returns true if it got any.
+ */
+static
+bool
+thread_steal_work(void)
+{
+	struct cpu *busiest;
+	unsigned count;
+
+	busiest = thread_busiest(&count);
+	if (busiest == NULL) {
+		return false;
+	}
+	/* Anything beats idling, so take hot threads too if need be. */
+	if (thread_steal(busiest, DIVROUNDUP(count, 2), false) > 0) {
+		return true;
+	}
+	return thread_steal(busiest, DIVROUNDUP(count, 2), true) > 0;
+}
+
+/*
+ * TARGETCPU, which is busy, has just been given a thread to run. If
+ * some other cpu is idle, wake it up so it can come and take it.
+ */
+static
+void
+thread_kick_idle(struct cpu *targetcpu)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != targetcpu && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * Choose the cpu to wake up the sleeping thread T on. The cpu it last
+ * ran on is best if that is idle; failing that, any idle cpu. If all
+ * are busy, take the one with the fewest threads to run, counting the
+ * last cpu as SCHED_AFFINITY threads less loaded if T is still hot
+ * there. Loads are unlocked estimates.
+ */
+static
+struct cpu *
+thread_wakeup_cpu(struct thread *t)
+{
+	struct cpu *c, *best;
+	unsigned i, numcpus;
+	int load, bestload;
+
+	if (t->t_cpu->c_isidle) {
+		return t->t_cpu;
+	}
+	if (curcpu->c_isidle) {
+		/* Woken from an interrupt on an idle cpu */
+		return curcpu->c_self;
+	}
+
+	best = t->t_cpu;
+	bestload = best->c_runcount + 1;
+	if (thread_is_hot(t)) {
+		bestload -= SCHED_AFFINITY;
+	}
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == t->t_cpu) {
+			continue;
+		}
+		if (c->c_isidle) {
+			return c;
+		}
+		load = c->c_runcount + 1;
+		if (load < bestload) {
+			best = c;
+			bestload = load;
+		}
+	}
+	return best;
+}
+
 /*
  * Make a thread runnable.
  *
@@ -451,6 +763,26 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 {
 	struct cpu *targetcpu;
 
+	/*
+	 * A thread being woken up can go to whichever cpu suits it
+	 * best, unless it's still on its way out of being its old
+	 * cpu's curthread (see thread_steal), which we can only
+	 * check with that cpu's run queue locked.
+	 */
+	if (!already_have_lock && target->t_state == S_SLEEP) {
+		targetcpu = thread_wakeup_cpu(target);
+		if (targetcpu != target->t_cpu) {
+			spinlock_acquire(&target->t_cpu->c_runqueue_lock);
+			if (target->t_cpu->c_curthread == target) {
+				targetcpu = target->t_cpu;
+			}
+			spinlock_release(&target->t_cpu->c_runqueue_lock);
+		}
+		if (targetcpu != target->t_cpu) {
+			thread_setcpu(target, targetcpu);
+		}
+	}
+
 	/* Lock the run queue of the target thread's cpu. */
 	targetcpu = target->t_cpu;
 
@@ -462,9 +794,21 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
+	/*
+	 * A thread waking up from sleep has been waiting rather than
+	 * computing, so move it up a priority and give it a fresh
+	 * time slice.
+	 */
+	if (target->t_state == S_SLEEP) {
+		if (target->t_priority > 0) {
+			target->t_priority--;
+		}
+		target->t_ticks = 0;
+	}
+
 	/* Target thread is now ready to run; put it on the run queue. */
 	target->t_state = S_READY;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runqueue_add(targetcpu, target);
 
 	if (targetcpu->c_isidle) {
 		/*
@@ -473,6 +817,13 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (!already_have_lock) {
+		/*
+		 * A new or newly woken thread that will have to wait
+		 * its turn; an idle cpu can steal it sooner.
+		 */
+		thread_kick_idle(targetcpu);
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -503,12 +854,7 @@ thread_fork(const char *name,
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
-	}
+	/* The stack came with the thread */
 	thread_checkstack_init(newthread);
 
 	/*
@@ -582,11 +928,14 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
+	/* Note when it stopped running, for thread_is_hot. */
+	cur->t_lastrun = curcpu->c_hardclocks;
+
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && curcpu->c_runcount == 0) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -632,17 +981,33 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	 * *is* atomic with respect to re-enabling interrupts.
 	 *
 	 * Note that c_isidle becomes true briefly even if we don't go
-	 * idle. However, because one is supposed to hold the runqueue
-	 * lock to look at it, this should not be visible or matter.
+	 * idle. Other cpus reading it without the lock may see that;
+	 * at worst they send us an unneeded IPI.
+	 *
+	 * Before idling, try to steal work from other cpus, then
+	 * look for background work from the VM system. That runs
+	 * with interrupts off, as we are in the middle of switching;
+	 * turn them on briefly after each batch, as cpu_idle would,
+	 * so interrupts aren't held off while a whole pool of pages
+	 * is cleared.
 	 */
 
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runqueue_remhead(curcpu->c_self);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (thread_steal_work()) {
+				/* go look at the run queue again */
+			}
+			else if (vm_idle_zero()) {
+				cpu_irqon();
+				cpu_irqoff();
+			}
+			else {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -782,9 +1147,12 @@ thread_exit(void)
 
 	/*
 	 * Detach from our process. You might need to move this action
-	 * around, depending on how your wait/exit works.
+	 * around, depending on how your wait/exit works. An orphan's
+	 * _exit has already done it, to destroy its own process.
 	 */
-	proc_remthread(cur);
+	if (cur->t_proc != NULL) {
+		proc_remthread(cur);
+	}
 
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
@@ -812,25 +1180,112 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * Threads are scheduled by a multi-level feedback queue. Each cpu has
+ * a run queue for each of CPU_NPRIORITIES priorities, and always runs
+ * the first thread of the highest-priority queue that has one. New
+ * threads start at priority 0, the highest.
+ *
+ * A thread at priority P runs for SCHED_QUANTUM(P) hardclocks before
+ * it has to yield, so lower priorities get longer but rarer turns. A
+ * thread that uses its whole time slice drops a priority; one that
+ * wakes up from sleeping moves up one. So threads that mostly wait
+ * for I/O stay near the top and get the cpu as soon as they want it,
+ * and threads that compute sink to the bottom and share what's left.
+ * A thread also yields at the next hardclock if a thread of higher
+ * priority is waiting.
+ *
+ * So that compute-bound threads can't be starved forever, every
+ * SCHED_BOOST_SCHEDULES calls schedule() moves every thread back up
+ * to priority 0.
  */
 
+#define SCHED_QUANTUM(pri)	(1U << (pri))	/* hardclocks */
+#define SCHED_BOOST_SCHEDULES	25		/* about once a second */
+
+/*
+ * This is called from hardclock() on every tick, to enforce the time
+ * slices described above.
+ */
+void
+thread_tick(void)
+{
+	struct thread *cur;
+	bool yield;
+	unsigned i;
+
+	cur = curthread;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	if (curcpu->c_isidle) {
+		/* Nothing is running; curthread is just left over. */
+		spinlock_release(&curcpu->c_runqueue_lock);
+		return;
+	}
+	cur->t_ticks++;
+	if (cur->t_ticks >= SCHED_QUANTUM(cur->t_priority)) {
+		if (cur->t_priority < CPU_NPRIORITIES - 1) {
+			cur->t_priority++;
+		}
+		cur->t_ticks = 0;
+		yield = true;
+	}
+	else {
+		yield = false;
+		for (i=0; i<cur->t_priority; i++) {
+			if (!threadlist_isempty(&curcpu->c_runqueue[i])) {
+				yield = true;
+				break;
+			}
+		}
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+
+	if (yield) {
+		thread_yield();
+	}
+}
+
+/*
+ * This is called periodically from hardclock(). Every
+ * SCHED_BOOST_SCHEDULES times, it moves all the threads on the
+ * current CPU back to priority 0.
+ */
 void
 schedule(void)
 {
-	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
-	 */
+	struct thread *t;
+	unsigned i;
+
+	curcpu->c_schedules++;
+	if (curcpu->c_schedules % SCHED_BOOST_SCHEDULES != 0) {
+		return;
+	}
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<CPU_NPRIORITIES; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i]))
+		       != NULL) {
+			t->t_priority = 0;
+			t->t_ticks = 0;
+			threadlist_addtail(&curcpu->c_runqueue[0], t);
+		}
+	}
+	if (!curcpu->c_isidle) {
+		curthread->t_priority = 0;
+		curthread->t_ticks = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
 }
 
 /*
  * Thread migration.
  *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * This is also called periodically from hardclock(). If another CPU
+ * has clearly more threads waiting to run than this one, take some
+ * of them, so the two end up about even. (Idle CPUs don't wait for
+ * this; they steal work as soon as they run out; see thread_switch.)
+ * Loads are compared using the unlocked estimates, so only the one
+ * run queue being taken from gets locked.
  *
  * Migrating threads isn't free because of cache affinity; a thread's
  * working cache set will end up having to be moved to the other CPU,
@@ -845,106 +1300,54 @@ schedule(void)
 void
 thread_consider_migration(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
+	struct cpu *busiest;
+	unsigned mine, most;
+
+	mine = curcpu->c_runcount;
+	busiest = thread_busiest(&most);
+	if (busiest == NULL || most < mine + 2) {
+		return;
+	}
+	/* Not worth moving threads that are still cache-hot. */
+	thread_steal(busiest, (most - mine) / 2, false);
+}
+
+/*
+ * Print scheduling statistics.
+ */
+void
+thread_printstats(void)
+{
 	struct cpu *c;
-	struct threadlist victims;
 	struct thread *t;
+	unsigned i, p, numcpus, exited, exitmigrations;
 
-	my_count = total_count = 0;
+	exited = exitmigrations = 0;
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
-		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
-		}
-		spinlock_release(&c->c_runqueue_lock);
-	}
-
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
-	}
-
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
-	}
-	spinlock_release(&curcpu->c_runqueue_lock);
+		exited += c->c_exited;
+		exitmigrations += c->c_exitmigrations;
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
-		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
-
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
+		kprintf("cpu%u: %s, %u ready\n", c->c_number,
+			c->c_isidle ? "idle" : "running", c->c_runcount);
+		if (!c->c_isidle) {
+			t = c->c_curthread;
+			kprintf("  %-24s running  pri %u, %u migrations\n",
+				t->t_name, t->t_priority, t->t_migrations);
+		}
+		for (p=0; p<CPU_NPRIORITIES; p++) {
+			THREADLIST_FORALL(t, c->c_runqueue[p]) {
+				kprintf("  %-24s ready    pri %u, "
+					"%u migrations\n", t->t_name,
+					t->t_priority, t->t_migrations);
 			}
 		}
 		spinlock_release(&c->c_runqueue_lock);
 	}
-
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
-	}
-
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+	kprintf("%u threads exited, with %u migrations\n",
+		exited, exitmigrations);
 }
 
 ////////////////////////////////////////////////////////////
@@ -988,6 +1391,15 @@ wchan_create(const char *name)
 	return wc;
 }
 
+/*
+ * Rename a wait channel.
+ */
+void
+wchan_setname(struct wchan *wc, const char *name)
+{
+	wc->wc_name = name;
+}
+
 /*
  * Destroy a wait channel. Must be empty and unlocked.
  * (The corresponding cleanup functions require this.)
@@ -1152,17 +1564,34 @@ ipi_broadcast(int code)
 void
 ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
 {
-	int n;
+	ipi_tlbshootdown_batch(target, mapping, 1);
+}
+
+void
+ipi_tlbshootdown_batch(struct cpu *target,
+		       const struct tlbshootdown *mappings, unsigned n)
+{
+	unsigned i;
+	int num;
 
 	spinlock_acquire(&target->c_ipi_lock);
 
-	n = target->c_numshootdown;
-	if (n == TLBSHOOTDOWN_MAX) {
-		target->c_numshootdown = TLBSHOOTDOWN_ALL;
-	}
-	else {
-		target->c_shootdown[n] = *mapping;
-		target->c_numshootdown = n+1;
+	/*
+	 * Add to whatever the target hasn't got to yet. Once the
+	 * array is full, flushing the whole TLB is the only option.
+	 */
+	for (i=0; i<n; i++) {
+		num = target->c_numshootdown;
+		if (num == TLBSHOOTDOWN_ALL) {
+			/* already flushing everything */
+			break;
+		}
+		else if (num == TLBSHOOTDOWN_MAX) {
+			target->c_numshootdown = TLBSHOOTDOWN_ALL;
+			break;
+		}
+		target->c_shootdown[num] = mappings[i];
+		target->c_numshootdown = num+1;
 	}
 
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
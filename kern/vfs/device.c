@@ -242,9 +242,11 @@ null_fsync(struct vnode *v)
  */
 static
 int
-dev_mmap(struct vnode *v  /* add stuff as needed */)
+dev_mmap(struct vnode *v, off_t offset, paddr_t *ret)
 {
 	(void)v;
+	(void)offset;
+	(void)ret;
 	return ENOSYS;
 }
 
@@ -36,6 +36,7 @@
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <pagecache.h>
 
 /*
  * Initialize an abstract vnode.
@@ -52,6 +53,7 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	spinlock_init(&vn->vn_countlock);
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
+	vn->vn_pagecache = NULL;
 	return 0;
 }
 
@@ -63,6 +65,9 @@ vnode_cleanup(struct vnode *vn)
 {
 	KASSERT(vn->vn_refcount == 1);
 
+	/* Nobody can have the file mapped any more. */
+	pagecache_destroy(vn);
+
 	spinlock_cleanup(&vn->vn_countlock);
 
 	vn->vn_ops = NULL;
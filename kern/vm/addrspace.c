@@ -31,11 +31,15 @@
 #include <kern/errno.h>
 #include <lib.h>
 #include <addrspace.h>
+#include <pagetable.h>
 #include <vm.h>
 #include <proc.h>
 #include <spl.h>
 #include <mips/tlb.h>
 #include <current.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -43,65 +47,152 @@
  * used. The cheesy hack versions in dumbvm.c are used instead.
  */
 
-static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
+/*
+ * Every address space, so the page-out code can find the remaining
+ * sharer of a page whose recorded owner has dropped it.
+ */
+static struct addrspace *as_all;
+static struct spinlock as_all_lock = SPINLOCK_INITIALIZER;
 
 struct addrspace *
 as_create(void)
 {
 	struct addrspace *as = kmalloc(sizeof(struct addrspace));
+	unsigned i;
+
 	if (as == NULL) {
 		return NULL;
 	}
 
-	// temporarily using DUMBVM code
-    as->as_vbase1 = 0;
-	as->as_pbase1 = 0;
-	as->as_npages1 = 0;
-	as->as_vbase2 = 0;
-	as->as_pbase2 = 0;
-	as->as_npages2 = 0;
-	as->as_stackpbase = 0;
+	as->as_pt = pt_create();
+	if (as->as_pt == NULL) {
+		kfree(as);
+		return NULL;
+	}
+	as->as_lock = lock_create("addrspace");
+	if (as->as_lock == NULL) {
+		pt_destroy(as->as_pt, as);
+		kfree(as);
+		return NULL;
+	}
+	as->as_regions = NULL;
+	as->as_heap = NULL;
+	as->as_stack = NULL;
+	as->as_stacklimit = VM_STACKLIMIT;
+	for (i = 0; i < MAXCPUS; i++) {
+		as->as_asid[i] = 0;
+		as->as_asidgen[i] = 0;
+	}
+	as->as_cpumask = 0;
+	as->as_tlbmisses = 0;
+	as->as_tlbevictions = 0;
+	as->as_prefetched = 0;
+
+	spinlock_acquire(&as_all_lock);
+	as->as_next = as_all;
+	as_all = as;
+	spinlock_release(&as_all_lock);
 
 	return as;
 }
 
+/*
+ * Append a region to the address space's region list. Returns NULL on
+ * out-of-memory.
+ */
+static
+struct region *
+as_add_region(struct addrspace *as, vaddr_t vaddr, size_t npages, int perms)
+{
+	struct region *rg, **tail;
+
+	rg = kmalloc(sizeof(struct region));
+	if (rg == NULL) {
+		return NULL;
+	}
+	rg->rg_vbase = vaddr;
+	rg->rg_npages = npages;
+	rg->rg_perms = perms;
+	rg->rg_flags = 0;
+	rg->rg_vnode = NULL;
+	rg->rg_offset = 0;
+	rg->rg_filevaddr = 0;
+	rg->rg_filesz = 0;
+	rg->rg_fastart = 0;
+	rg->rg_fanext = 0;
+	rg->rg_fawindow = 0;
+	rg->rg_famax = VM_FAULTAROUND_MAX;
+	rg->rg_next = NULL;
+
+	for (tail = &as->as_regions; *tail != NULL; tail = &(*tail)->rg_next);
+	*tail = rg;
+
+	return rg;
+}
+
+/*
+ * Lowest address the stack may ever need, counting its guard page.
+ * Nothing else is placed at or above it.
+ */
+static
+vaddr_t
+as_stack_floor(struct addrspace *as)
+{
+	return USERSTACK - (as->as_stacklimit + 1) * PAGE_SIZE;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
 	struct addrspace *newas;
+	struct region *rg, *newrg;
+	int result;
 
 	newas = as_create();
 	if (newas==NULL) {
 		return ENOMEM;
 	}
-
-	// temporarily using DUMBVM code
-    newas->as_vbase1 = old->as_vbase1;
-	newas->as_npages1 = old->as_npages1;
-	newas->as_vbase2 = old->as_vbase2;
-	newas->as_npages2 = old->as_npages2;
-
-	/* (Mis)use as_prepare_load to allocate some physical memory. */
-	if (as_prepare_load(newas)) {
-		as_destroy(newas);
-		return ENOMEM;
+	newas->as_stacklimit = old->as_stacklimit;
+
+	for (rg = old->as_regions; rg != NULL; rg = rg->rg_next) {
+		newrg = as_add_region(newas, rg->rg_vbase, rg->rg_npages,
+				      rg->rg_perms);
+		if (newrg == NULL) {
+			as_destroy(newas);
+			return ENOMEM;
+		}
+		newrg->rg_flags = rg->rg_flags;
+		newrg->rg_famax = rg->rg_famax;
+		if (rg == old->as_heap) {
+			newas->as_heap = newrg;
+		}
+		if (rg == old->as_stack) {
+			newas->as_stack = newrg;
+		}
+		if (rg->rg_vnode != NULL) {
+			result = as_map_file(newas, rg->rg_vnode, rg->rg_offset,
+					     rg->rg_filevaddr, rg->rg_filesz);
+			KASSERT(result == 0);
+		}
 	}
 
-	KASSERT(newas->as_pbase1 != 0);
-	KASSERT(newas->as_pbase2 != 0);
-	KASSERT(newas->as_stackpbase != 0);
+	lock_acquire(old->as_lock);
+	lock_acquire(newas->as_lock);
+	result = pt_copy(old->as_pt, newas->as_pt);
 
-	memmove((void *)PADDR_TO_KVADDR(newas->as_pbase1),
-		(const void *)PADDR_TO_KVADDR(old->as_pbase1),
-		old->as_npages1*PAGE_SIZE);
-
-	memmove((void *)PADDR_TO_KVADDR(newas->as_pbase2),
-		(const void *)PADDR_TO_KVADDR(old->as_pbase2),
-		old->as_npages2*PAGE_SIZE);
+	/*
+	 * Pages are now shared copy-on-write, but the TLB may still hold
+	 * writable entries for them. Drop those even if the copy failed
+	 * partway, since some pages were already marked.
+	 */
+	vm_tlb_invalidate(old);
+	lock_release(newas->as_lock);
+	lock_release(old->as_lock);
 
-	memmove((void *)PADDR_TO_KVADDR(newas->as_stackpbase),
-		(const void *)PADDR_TO_KVADDR(old->as_stackpbase),
-		COREMAP_PAGES*PAGE_SIZE);
+	if (result) {
+		as_destroy(newas);
+		return result;
+	}
 
 	*ret = newas;
 	return 0;
@@ -110,9 +201,35 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+	struct addrspace **pp;
+	struct region *rg;
+
+	DEBUG(DB_VM, "vm: as %p: %u TLB misses, %u replacements, "
+	      "%u pages faulted around\n",
+	      as, as->as_tlbmisses, as->as_tlbevictions, as->as_prefetched);
+
+	/* before the pages go, so as_find_mapper can't see a dead pt */
+	spinlock_acquire(&as_all_lock);
+	for (pp = &as_all; *pp != as; pp = &(*pp)->as_next) {
+		KASSERT(*pp != NULL);
+	}
+	*pp = as->as_next;
+	spinlock_release(&as_all_lock);
+
+	// give every page back to the coremap or swap
+	lock_acquire(as->as_lock);
+	pt_destroy(as->as_pt, as);
+	lock_release(as->as_lock);
+	lock_destroy(as->as_lock);
+
+	while (as->as_regions != NULL) {
+		rg = as->as_regions;
+		as->as_regions = rg->rg_next;
+		if (rg->rg_vnode != NULL) {
+			VOP_DECREF(rg->rg_vnode);
+		}
+		kfree(rg);
+	}
 
 	kfree(as);
 }
@@ -120,32 +237,30 @@ as_destroy(struct addrspace *as)
 void
 as_activate(void)
 {
-    // temporarily using DUMBVM code
-	int i, spl;
 	struct addrspace *as;
 
 	as = proc_getas();
 	if (as == NULL) {
+		/*
+		 * Kernel-only thread. It never touches user addresses,
+		 * so whatever is in the TLB can stay there.
+		 */
 		return;
 	}
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
-
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
-	}
-
-	splx(spl);
+	/*
+	 * Entries are tagged with the address space ID, so switching
+	 * only changes the current ASID; nothing is flushed.
+	 */
+	vm_tlb_activate(as);
 }
 
 void
 as_deactivate(void)
 {
 	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
+	 * Nothing to do: entries tagged with this address space's ASID
+	 * are never matched once another ASID is current.
 	 */
 }
 
@@ -155,17 +270,17 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. Writes
+ * to a region without WRITEABLE fault once loading is complete.
+ * MIPS cannot enforce read or execute permission separately, so those
+ * are only recorded.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 		 int readable, int writeable, int executable)
 {
-	// temporarily using DUMBVM code
-
 	size_t npages;
+	int perms = 0;
 
 	/* Align the region. First, the base... */
 	sz += vaddr & ~(vaddr_t)PAGE_FRAME;
@@ -176,205 +291,466 @@ as_define_region(struct addrspace *as, vaddr_t vaddr, size_t sz,
 
 	npages = sz / PAGE_SIZE;
 
-	/* We don't use these - all pages are read-write */
-	(void)readable;
-	(void)writeable;
-	(void)executable;
+	if (vaddr >= USERSPACETOP || sz > USERSPACETOP - vaddr) {
+		return EFAULT;
+	}
 
-	if (as->as_vbase1 == 0) {
-		as->as_vbase1 = vaddr;
-		as->as_npages1 = npages;
-		return 0;
+	if (readable) {
+		perms |= RG_R;
+	}
+	if (writeable) {
+		perms |= RG_W;
+	}
+	if (executable) {
+		perms |= RG_X;
 	}
 
-	if (as->as_vbase2 == 0) {
-		as->as_vbase2 = vaddr;
-		as->as_npages2 = npages;
-		return 0;
+	if (as_add_region(as, vaddr, npages, perms) == NULL) {
+		return ENOMEM;
 	}
+	return 0;
+}
 
+int
+as_prepare_load(struct addrspace *as)
+{
 	/*
-	 * Support for more than two regions is not available.
+	 * Nothing to do: load_elf only records where each segment lives
+	 * in the file and vm_fault reads pages in as they are touched.
 	 */
-	kprintf("dumbvm: Warning: too many regions\n");
-	return ENOSYS;
+	(void)as;
+	return 0;
 }
 
-static
-void
-as_zero_region(paddr_t paddr, unsigned npages)
+/*
+ * Start the heap, empty, at the first page past every segment.
+ */
+int
+as_complete_load(struct addrspace *as)
 {
-	bzero((void *)PADDR_TO_KVADDR(paddr), npages * PAGE_SIZE);
+	struct region *rg;
+	vaddr_t heapbase = 0;
+
+	KASSERT(as->as_heap == NULL);
+
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg->rg_vbase + rg->rg_npages * PAGE_SIZE > heapbase) {
+			heapbase = rg->rg_vbase + rg->rg_npages * PAGE_SIZE;
+		}
+	}
+
+	as->as_heap = as_add_region(as, heapbase, 0, RG_R | RG_W);
+	if (as->as_heap == NULL) {
+		return ENOMEM;
+	}
+	return 0;
 }
 
-static
-paddr_t
-getppages(unsigned long npages)
+int
+as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	paddr_t addr;
+	int result;
 
-	spinlock_acquire(&stealmem_lock);
+	KASSERT(VM_STACKPAGES <= as->as_stacklimit);
 
-	addr = ram_stealmem(npages);
+	as->as_stack = as_add_region(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+				     VM_STACKPAGES, RG_R | RG_W);
+	if (as->as_stack == NULL) {
+		return ENOMEM;
+	}
 
-	spinlock_release(&stealmem_lock);
-	return addr;
+	/*
+	 * The stack grows down, so mapping the pages above a fault
+	 * would only map what is already there.
+	 */
+	result = as_set_faultaround(as, USERSTACK - PAGE_SIZE, 0);
+	KASSERT(result == 0);
+
+	/* Initial user-level stack pointer */
+	*stackptr = USERSTACK;
+
+	return 0;
 }
 
-int
-as_prepare_load(struct addrspace *as)
+struct region *
+as_find_region(struct addrspace *as, vaddr_t vaddr)
 {
-	// temporarily using DUMBVM code
-	KASSERT(as->as_pbase1 == 0);
-	KASSERT(as->as_pbase2 == 0);
-	KASSERT(as->as_stackpbase == 0);
+	struct region *rg;
 
-	as->as_pbase1 = getppages(as->as_npages1);
-	if (as->as_pbase1 == 0) {
-		return ENOMEM;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (vaddr >= rg->rg_vbase &&
+		    vaddr - rg->rg_vbase < rg->rg_npages * PAGE_SIZE) {
+			return rg;
+		}
 	}
 
-	as->as_pbase2 = getppages(as->as_npages2);
-	if (as->as_pbase2 == 0) {
-		return ENOMEM;
+	return NULL;
+}
+
+struct region *
+as_grow_stack(struct addrspace *as, vaddr_t vaddr)
+{
+	struct region *stack = as->as_stack, *rg;
+
+	vaddr &= PAGE_FRAME;
+	if (stack == NULL || vaddr >= stack->rg_vbase ||
+	    vaddr < USERSTACK - as->as_stacklimit * PAGE_SIZE) {
+		return NULL;
 	}
 
-	as->as_stackpbase = getppages(COREMAP_PAGES);
-	if (as->as_stackpbase == 0) {
-		return ENOMEM;
+	/*
+	 * Nothing else is placed above the guard page, but an
+	 * executable could still have put a segment there.
+	 */
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg != stack && rg->rg_vbase < stack->rg_vbase &&
+		    rg->rg_vbase + rg->rg_npages * PAGE_SIZE >
+		    vaddr - PAGE_SIZE) {
+			return NULL;
+		}
+	}
+
+	stack->rg_npages += (stack->rg_vbase - vaddr) / PAGE_SIZE;
+	stack->rg_vbase = vaddr;
+	return stack;
+}
+
+struct addrspace *
+as_find_mapper(vaddr_t vaddr, paddr_t paddr)
+{
+	struct addrspace *as;
+	pte_t *pte;
+
+	spinlock_acquire(&as_all_lock);
+	for (as = as_all; as != NULL; as = as->as_next) {
+		pte = pt_lookup(as->as_pt, vaddr, false);
+		if (pte != NULL &&
+		    (*pte & (PTE_FRAME | PTE_VALID)) == (paddr | PTE_VALID)) {
+			break;
+		}
+	}
+	spinlock_release(&as_all_lock);
+
+	return as;
+}
+
+int
+as_set_stacklimit(struct addrspace *as, size_t npages)
+{
+	struct region *rg;
+	vaddr_t floor;
+
+	/* Leave page 0 and the guard page out of it. */
+	if (npages < VM_STACKPAGES || npages >= USERSTACK / PAGE_SIZE - 1) {
+		return EINVAL;
+	}
+	if (as->as_stack != NULL && as->as_stack->rg_npages > npages) {
+		return EINVAL;
 	}
 
-	as_zero_region(as->as_pbase1, as->as_npages1);
-	as_zero_region(as->as_pbase2, as->as_npages2);
-	as_zero_region(as->as_stackpbase, COREMAP_PAGES);
+	floor = USERSTACK - (npages + 1) * PAGE_SIZE;
+	for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+		if (rg != as->as_stack &&
+		    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > floor) {
+			return EINVAL;
+		}
+	}
 
+	as->as_stacklimit = npages;
 	return 0;
 }
 
 int
-as_complete_load(struct addrspace *as)
+as_set_faultaround(struct addrspace *as, vaddr_t vaddr, unsigned npages)
 {
-	/*
-	 * Write this.
-	 */
+	struct region *rg;
+
+	rg = as_find_region(as, vaddr);
+	if (rg == NULL) {
+		return EFAULT;
+	}
+	if (npages > VM_FAULTAROUND_MAX) {
+		npages = VM_FAULTAROUND_MAX;
+	}
+
+	lock_acquire(as->as_lock);
+	rg->rg_famax = npages;
+	if (rg->rg_fawindow > npages) {
+		rg->rg_fawindow = npages;
+	}
+	lock_release(as->as_lock);
 
-	(void)as;
 	return 0;
 }
 
 int
-as_define_stack(struct addrspace *as, vaddr_t *stackptr)
+as_set_break(struct addrspace *as, vaddr_t newbreak)
 {
-	/*
-	 * Write this.
-	 */
-    // temporarily using DUMBVM code
-	KASSERT(as->as_stackpbase != 0);
+	struct region *heap = as->as_heap, *rg;
+	vaddr_t oldbreak;
 
-	/* Initial user-level stack pointer */
-	*stackptr = USERSTACK;
+	KASSERT(heap != NULL);
+	KASSERT((newbreak & PAGE_FRAME) == newbreak);
+
+	oldbreak = heap->rg_vbase + heap->rg_npages * PAGE_SIZE;
+	if (newbreak < heap->rg_vbase) {
+		return EINVAL;
+	}
+
+	if (newbreak > oldbreak) {
+		/* Don't grow into the stack or anything else. */
+		if (newbreak > as_stack_floor(as)) {
+			return ENOMEM;
+		}
+		for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+			if (rg != heap && rg->rg_vbase >= oldbreak &&
+			    rg->rg_vbase < newbreak) {
+				return ENOMEM;
+			}
+		}
+	}
+	else if (newbreak < oldbreak) {
+		/* Give back everything past the new break. */
+		lock_acquire(as->as_lock);
+		vm_tlb_unmap(as, newbreak, oldbreak);
+		pt_unmap(as->as_pt, as, newbreak, oldbreak);
+		lock_release(as->as_lock);
+	}
+
+	heap->rg_npages = (newbreak - heap->rg_vbase) / PAGE_SIZE;
+	return 0;
+}
+
+/*
+ * Find NPAGES unused pages for a mapping, searching down from below
+ * the stack's guard page towards the break. Returns 0 if there is no
+ * room.
+ */
+static
+vaddr_t
+as_find_gap(struct addrspace *as, size_t npages)
+{
+	struct region *rg;
+	vaddr_t top, floor;
+	size_t size = npages * PAGE_SIZE;
+
+	KASSERT(as->as_heap != NULL);
+
+	top = as_stack_floor(as);
+	floor = as->as_heap->rg_vbase + as->as_heap->rg_npages * PAGE_SIZE;
+
+	while (top >= floor && top - floor >= size) {
+		for (rg = as->as_regions; rg != NULL; rg = rg->rg_next) {
+			if (rg->rg_vbase < top &&
+			    rg->rg_vbase + rg->rg_npages * PAGE_SIZE > top - size) {
+				break;
+			}
+		}
+		if (rg == NULL) {
+			return top - size;
+		}
+		/* Overlaps; try again just below it. */
+		top = rg->rg_vbase;
+	}
 
 	return 0;
 }
 
 int
-vm_fault(int faulttype, vaddr_t faultaddress)
+as_mmap(struct addrspace *as, struct vnode *v, off_t offset, size_t npages,
+	int perms, vaddr_t *ret)
 {
-    // temporarily using DUMBVM code
-	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
-	paddr_t paddr;
-	int i;
-	uint32_t ehi, elo;
-	struct addrspace *as;
-	int spl;
+	struct region *rg;
+	vaddr_t vaddr;
+	int result;
+
+	KASSERT(offset % PAGE_SIZE == 0);
+
+	vaddr = as_find_gap(as, npages);
+	if (vaddr == 0) {
+		return ENOMEM;
+	}
 
-	faultaddress &= PAGE_FRAME;
+	rg = as_add_region(as, vaddr, npages, perms);
+	if (rg == NULL) {
+		return ENOMEM;
+	}
+	rg->rg_flags = RGF_PAGECACHE | RGF_MMAP;
 
-	DEBUG(DB_VM, "dumbvm: fault: 0x%x\n", faultaddress);
+	result = as_map_file(as, v, offset, vaddr, npages * PAGE_SIZE);
+	KASSERT(result == 0);
 
-	switch (faulttype) {
-	    case VM_FAULT_READONLY:
-		/* We always create pages read-write, so we can't get this */
-		panic("dumbvm: got VM_FAULT_READONLY\n");
-	    case VM_FAULT_READ:
-	    case VM_FAULT_WRITE:
-		break;
-	    default:
+	*ret = vaddr;
+	return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t vaddr, size_t npages)
+{
+	struct region *rg, **prev;
+
+	for (prev = &as->as_regions; *prev != NULL; prev = &(*prev)->rg_next) {
+		if ((*prev)->rg_vbase == vaddr) {
+			break;
+		}
+	}
+
+	rg = *prev;
+	if (rg == NULL || !(rg->rg_flags & RGF_MMAP) || rg->rg_npages != npages) {
 		return EINVAL;
 	}
 
-	if (curproc == NULL) {
-		/*
-		 * No process. This is probably a kernel fault early
-		 * in boot. Return EFAULT so as to panic instead of
-		 * getting into an infinite faulting loop.
-		 */
+	lock_acquire(as->as_lock);
+	vm_tlb_unmap(as, vaddr, vaddr + npages * PAGE_SIZE);
+	pt_unmap(as->as_pt, as, vaddr, vaddr + npages * PAGE_SIZE);
+	lock_release(as->as_lock);
+
+	*prev = rg->rg_next;
+	VOP_DECREF(rg->rg_vnode);
+	kfree(rg);
+
+	return 0;
+}
+
+int
+as_map_file(struct addrspace *as, struct vnode *v, off_t offset,
+	    vaddr_t vaddr, size_t filesz)
+{
+	struct region *rg;
+
+	rg = as_find_region(as, vaddr);
+	if (rg == NULL || rg->rg_vnode != NULL) {
 		return EFAULT;
 	}
-
-	as = proc_getas();
-	if (as == NULL) {
-		/*
-		 * No address space set up. This is probably also a
-		 * kernel fault early in boot.
-		 */
+	if (filesz > rg->rg_npages * PAGE_SIZE - (vaddr - rg->rg_vbase)) {
 		return EFAULT;
 	}
 
-	/* Assert that the address space has been set up properly. */
-	KASSERT(as->as_vbase1 != 0);
-	KASSERT(as->as_pbase1 != 0);
-	KASSERT(as->as_npages1 != 0);
-	KASSERT(as->as_vbase2 != 0);
-	KASSERT(as->as_pbase2 != 0);
-	KASSERT(as->as_npages2 != 0);
-	KASSERT(as->as_stackpbase != 0);
-	KASSERT((as->as_vbase1 & PAGE_FRAME) == as->as_vbase1);
-	KASSERT((as->as_pbase1 & PAGE_FRAME) == as->as_pbase1);
-	KASSERT((as->as_vbase2 & PAGE_FRAME) == as->as_vbase2);
-	KASSERT((as->as_pbase2 & PAGE_FRAME) == as->as_pbase2);
-	KASSERT((as->as_stackpbase & PAGE_FRAME) == as->as_stackpbase);
-
-	vbase1 = as->as_vbase1;
-	vtop1 = vbase1 + as->as_npages1 * PAGE_SIZE;
-	vbase2 = as->as_vbase2;
-	vtop2 = vbase2 + as->as_npages2 * PAGE_SIZE;
-	stackbase = USERSTACK - COREMAP_PAGES * PAGE_SIZE;
-	stacktop = USERSTACK;
-
-	if (faultaddress >= vbase1 && faultaddress < vtop1) {
-		paddr = (faultaddress - vbase1) + as->as_pbase1;
-	}
-	else if (faultaddress >= vbase2 && faultaddress < vtop2) {
-		paddr = (faultaddress - vbase2) + as->as_pbase2;
-	}
-	else if (faultaddress >= stackbase && faultaddress < stacktop) {
-		paddr = (faultaddress - stackbase) + as->as_stackpbase;
-	}
-	else {
-		return EFAULT;
+	VOP_INCREF(v);
+	rg->rg_vnode = v;
+	rg->rg_offset = offset;
+	rg->rg_filevaddr = vaddr;
+	rg->rg_filesz = filesz;
+
+	return 0;
+}
+
+int
+as_share_file(struct addrspace *as, struct vnode *v, off_t offset,
+	      vaddr_t vaddr, size_t filesz)
+{
+	struct region *rg;
+	vaddr_t skip;
+	int result;
+
+	result = as_map_file(as, v, offset, vaddr, filesz);
+	if (result) {
+		return result;
 	}
 
-	/* make sure it's page-aligned */
-	KASSERT((paddr & PAGE_FRAME) == paddr);
+	/*
+	 * Cached pages are whole pages of the file, so the segment must
+	 * sit at the same offset within its page in memory as in the
+	 * file, and must not need any page zero-filled. Writable
+	 * regions stay private: the page cache only shares read-only.
+	 */
+	rg = as_find_region(as, vaddr);
+	skip = vaddr - rg->rg_vbase;
+	if ((rg->rg_perms & RG_W) || rg->rg_flags != 0 ||
+	    (vaddr - offset) % PAGE_SIZE != 0 ||
+	    rg->rg_vbase + rg->rg_npages * PAGE_SIZE >
+	    ROUNDUP(vaddr + filesz, PAGE_SIZE)) {
+		return 0;
+	}
 
-	/* Disable interrupts on this CPU while frobbing the TLB. */
-	spl = splhigh();
+	KASSERT(offset >= (off_t)skip);
+	rg->rg_flags |= RGF_PAGECACHE;
+	rg->rg_offset = offset - skip;
+	rg->rg_filevaddr = rg->rg_vbase;
+	rg->rg_filesz = filesz + skip;
 
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
+	return 0;
+}
+
+bool
+region_page_has_file(struct region *rg, vaddr_t vaddr)
+{
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+
+	return rg->rg_vnode != NULL &&
+		vaddr + PAGE_SIZE > rg->rg_filevaddr &&
+		vaddr < rg->rg_filevaddr + rg->rg_filesz;
+}
+
+int
+region_fill_page(struct region *rg, vaddr_t vaddr, paddr_t paddr)
+{
+	return region_fill_pages(rg, vaddr, &paddr, 1);
+}
+
+int
+region_fill_pages(struct region *rg, vaddr_t vaddr, const paddr_t *paddrs,
+		  unsigned npages)
+{
+	struct iovec iov[VM_FAULTAROUND_MAX];
+	struct uio ku;
+	vaddr_t start, end, pstart, pend, page;
+	unsigned i, niov;
+	int result;
+
+	KASSERT((vaddr & PAGE_FRAME) == vaddr);
+	KASSERT(npages > 0 && npages <= VM_FAULTAROUND_MAX);
+
+	if (rg->rg_vnode == NULL) {
+		return 0;
+	}
+
+	/* Clip the pages against the file-backed part of the region. */
+	start = vaddr > rg->rg_filevaddr ? vaddr : rg->rg_filevaddr;
+	end = vaddr + npages * PAGE_SIZE;
+	if (end > rg->rg_filevaddr + rg->rg_filesz) {
+		end = rg->rg_filevaddr + rg->rg_filesz;
+	}
+	if (start >= end) {
+		/* BSS: stays zero */
+		return 0;
+	}
+
+	/*
+	 * The file part is contiguous, so one read with an iovec for
+	 * each page it touches fills them all.
+	 */
+	niov = 0;
+	for (i = 0; i < npages; i++) {
+		page = vaddr + i * PAGE_SIZE;
+		pstart = page > start ? page : start;
+		pend = page + PAGE_SIZE < end ? page + PAGE_SIZE : end;
+		if (pstart >= pend) {
 			continue;
 		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-		tlb_write(ehi, elo, i);
-		splx(spl);
-		return 0;
+		iov[niov].iov_kbase =
+			(void *)PADDR_TO_KVADDR(paddrs[i] + (pstart - page));
+		iov[niov].iov_len = pend - pstart;
+		niov++;
+	}
+
+	ku.uio_iov = iov;
+	ku.uio_iovcnt = niov;
+	ku.uio_offset = rg->rg_offset + (start - rg->rg_filevaddr);
+	ku.uio_resid = end - start;
+	ku.uio_segflg = UIO_SYSSPACE;
+	ku.uio_rw = UIO_READ;
+	ku.uio_space = NULL;
+	result = VOP_READ(rg->rg_vnode, &ku);
+	if (result) {
+		return result;
 	}
 
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
-	splx(spl);
-	return EFAULT;
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+
+	return 0;
 }
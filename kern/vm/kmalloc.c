@@ -29,8 +29,13 @@
 
 #include <types.h>
 #include <lib.h>
+#include <spl.h>
 #include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
 #include <vm.h>
+#include <platform/maxcpus.h>
+#include "opt-kmsizes.h"
 
 /*
  * Kernel malloc.
@@ -78,6 +83,12 @@ fill_deadbeef(void *vptr, size_t len)
 //    cannot recursively use the subpage allocator. (We could probably
 //    make that work, but it would be painful.)
 //
+//    In front of the pages, each CPU keeps a magazine of free blocks
+//    of each size. Most kmalloc/kfree calls only push or pop a
+//    block there, with interrupts off but no lock held; only when a
+//    magazine runs empty or full is the global lock taken, to move
+//    half a magazine's worth of blocks at once.
+//
 
 ////////////////////////////////////////
 
@@ -111,6 +122,13 @@ fill_deadbeef(void *vptr, size_t len)
  * CHECKGUARDS checks that allocated blocks' guard bands are intact
  * when checking kernel heap pages with SLOW and SLOWER. This is also
  * quite slow in its own right.
+ *
+ * Independently, SIZEHIST records how many subpage allocations of
+ * each size are made, for kheap_printsizes. Its suggested size
+ * classes can be put in kmalloc_sizes.h and used by building with
+ * "options kmsizes". Sizes are recorded after the overhead of GUARDS
+ * and LABELS is added, so measure with the same settings the classes
+ * will be used with.
  */
 
 #undef  SLOW
@@ -121,14 +139,25 @@ fill_deadbeef(void *vptr, size_t len)
 #undef CHECKBEEF
 #undef CHECKGUARDS
 
+#undef SIZEHIST
+
 ////////////////////////////////////////
 
 #if PAGE_SIZE == 4096
 
+#if OPT_KMSIZES
+/* Size classes fitted to a measured workload; see SIZEHIST above. */
+#include "kmalloc_sizes.h"
+#define NSIZES KMALLOC_NSIZES
+static const size_t sizes[NSIZES] = { KMALLOC_SIZES };
+
+#define SMALLEST_SUBPAGE_SIZE KMALLOC_SMALLEST
+#else
 #define NSIZES 8
 static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 
 #define SMALLEST_SUBPAGE_SIZE 16
+#endif
 #define LARGEST_SUBPAGE_SIZE 2048
 
 #elif PAGE_SIZE == 8192
@@ -137,6 +166,23 @@ static const size_t sizes[NSIZES] = { 16, 32, 64, 128, 256, 512, 1024, 2048 };
 #error "Odd page size"
 #endif
 
+/*
+ * All sizes are multiples of SIZEUNIT, so the block type for a size
+ * can be looked up in blocktypes[] by the size in SIZEUNITs. The
+ * table is filled in by the first kmalloc, early in boot while there
+ * is still only one thread.
+ */
+#define SIZEUNIT 8
+#define NSIZEUNITS (LARGEST_SUBPAGE_SIZE / SIZEUNIT + 1)
+
+static uint8_t blocktypes[NSIZEUNITS];
+static bool blocktypes_ready;
+
+#ifdef SIZEHIST
+/* Number of subpage allocations of each size, by SIZEUNIT. */
+static unsigned sizehist[NSIZEUNITS];
+#endif
+
 ////////////////////////////////////////
 
 struct freelist {
@@ -160,10 +206,8 @@ struct pageref {
 ////////////////////////////////////////
 
 /*
- * Use one spinlock for the whole thing. Making parts of the kmalloc
- * logic per-cpu is worthwhile for scalability; however, for the time
- * being at least we won't, because it adds a lot of complexity and in
- * OS/161 performance and scalability aren't super-critical.
+ * One spinlock protects all the pages and pagerefs. The per-cpu
+ * magazines (below) keep most allocations from ever taking it.
  */
 
 static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
@@ -212,6 +256,17 @@ struct kheap_root {
 
 static struct kheap_root kheaproots[NUM_PAGEREFPAGES];
 
+/*
+ * The pageref of each heap page, indexed by physical page number, so
+ * kfree can find a block's page without searching. This covers the
+ * first TOTAL_PAGEREFS pages (16M) of RAM; pages above that, on
+ * machines with more, are found by searching allbase as before.
+ * An entry is only set while its page holds subpage blocks.
+ */
+static struct pageref *pagerefs_bypage[TOTAL_PAGEREFS];
+
+#define PAGEREF_INDEX(va)  (KVADDR_TO_PADDR(va) / PAGE_SIZE)
+
 /*
  * Allocate a page to hold pagerefs.
  */
@@ -450,6 +505,15 @@ checkguardband(vaddr_t blockaddr, size_t smallerblocksize, size_t blocksize)
 #endif
 #endif
 
+/*
+ * MAGAZINES enables the per-cpu magazines. Blocks sitting in a
+ * magazine look allocated to the page checks done by SLOW, so the
+ * magazines are bypassed when it is on.
+ */
+#ifndef SLOW
+#define MAGAZINES
+#endif
+
 #ifdef CHECKBEEF
 /*
  * Check that a (free) block contains deadbeef as it should.
@@ -691,12 +755,276 @@ dump_subpages(unsigned generation)
 	}
 }
 
+////////////////////////////////////////
+
+/*
+ * Allocation profiling. While it is on, kmalloc and kfree keep count,
+ * for each allocation site (the label), of how many allocations and
+ * frees it has made and how much memory it holds. Sites hash into
+ * khprof_sites[1..KHPROF_NSITES-1]; if that fills up, further sites
+ * are lumped together in khprof_sites[0], which is kept for them.
+ *
+ * Frees are matched to their site by the block's label. Blocks from
+ * before profiling was last started or reset are recognized by their
+ * generation and not counted. Whole-page allocations have no label,
+ * so up to KHPROF_NPAGEALLOCS of them are remembered in
+ * khprof_pageallocs[]; beyond that they are not profiled.
+ */
+
+#define KHPROF_NSITES 256
+#define KHPROF_NPAGEALLOCS 128
+
+struct khprof_site {
+	vaddr_t ks_label;		/* 0 if unused */
+	unsigned ks_nallocs;
+	unsigned ks_nfrees;
+	size_t ks_livebytes;
+};
+
+struct khprof_pagealloc {
+	vaddr_t kp_addr;		/* 0 if unused */
+	vaddr_t kp_label;
+	size_t kp_size;
+};
+
+static struct spinlock khprof_spinlock = SPINLOCK_INITIALIZER;
+static volatile bool khprof_on;
+static unsigned khprof_generation;
+static struct khprof_site khprof_sites[KHPROF_NSITES];
+static struct khprof_pagealloc khprof_pageallocs[KHPROF_NPAGEALLOCS];
+
+/*
+ * Find (or make) the entry for LABEL. Call with khprof_spinlock held.
+ */
+static
+struct khprof_site *
+khprof_site(vaddr_t label)
+{
+	unsigned start, i;
+	struct khprof_site *ks;
+
+	KASSERT(spinlock_do_i_hold(&khprof_spinlock));
+
+	KASSERT(label != 0);
+	start = ((uint32_t)label >> 2) * 2654435761U >> 24;
+	for (i=0; i<KHPROF_NSITES-1; i++) {
+		ks = &khprof_sites[1 + (start + i) % (KHPROF_NSITES-1)];
+		if (ks->ks_label == label) {
+			return ks;
+		}
+		if (ks->ks_label == 0) {
+			ks->ks_label = label;
+			return ks;
+		}
+	}
+	/* Full; use the catch-all entry. */
+	return &khprof_sites[0];
+}
+
+static
+void
+khprof_alloc(vaddr_t label, size_t size)
+{
+	struct khprof_site *ks;
+
+	spinlock_acquire(&khprof_spinlock);
+	ks = khprof_site(label);
+	ks->ks_nallocs++;
+	ks->ks_livebytes += size;
+	spinlock_release(&khprof_spinlock);
+}
+
+static
+void
+khprof_free(vaddr_t label, size_t size)
+{
+	struct khprof_site *ks;
+
+	spinlock_acquire(&khprof_spinlock);
+	ks = khprof_site(label);
+	ks->ks_nfrees++;
+	/* A block made just as profiling started might not be counted. */
+	ks->ks_livebytes -= size <= ks->ks_livebytes ? size : ks->ks_livebytes;
+	spinlock_release(&khprof_spinlock);
+}
+
+/*
+ * Profile a kfree of the subpage block labeled ML, of size SIZE.
+ */
+static
+void
+khprof_subpagefree(struct malloclabel *ml, size_t size)
+{
+	if (khprof_on && ml->generation >= khprof_generation) {
+		khprof_free(ml->label, size);
+	}
+}
+
+/*
+ * Profile a whole-page allocation of SIZE at ADDR.
+ */
+static
+void
+khprof_pagealloc(vaddr_t label, vaddr_t addr, size_t size)
+{
+	unsigned i;
+
+	if (!khprof_on) {
+		return;
+	}
+	spinlock_acquire(&khprof_spinlock);
+	for (i=0; i<KHPROF_NPAGEALLOCS; i++) {
+		if (khprof_pageallocs[i].kp_addr == 0) {
+			khprof_pageallocs[i].kp_addr = addr;
+			khprof_pageallocs[i].kp_label = label;
+			khprof_pageallocs[i].kp_size = size;
+			break;
+		}
+	}
+	spinlock_release(&khprof_spinlock);
+
+	if (i < KHPROF_NPAGEALLOCS) {
+		khprof_alloc(label, size);
+	}
+}
+
+/*
+ * Profile freeing the whole-page allocation at ADDR, if it was
+ * recorded.
+ */
+static
+void
+khprof_pagefree(vaddr_t addr)
+{
+	struct khprof_pagealloc kp;
+	unsigned i;
+
+	if (!khprof_on) {
+		return;
+	}
+	spinlock_acquire(&khprof_spinlock);
+	for (i=0; i<KHPROF_NPAGEALLOCS; i++) {
+		if (khprof_pageallocs[i].kp_addr == addr) {
+			kp = khprof_pageallocs[i];
+			khprof_pageallocs[i].kp_addr = 0;
+			break;
+		}
+	}
+	spinlock_release(&khprof_spinlock);
+
+	if (i < KHPROF_NPAGEALLOCS) {
+		khprof_free(kp.kp_label, kp.kp_size);
+	}
+}
+
 #else
 
 #define LABEL_OVERHEAD 0
 
 #endif /* LABELS */
 
+/*
+ * Turn allocation profiling on or off. Turning it on starts over.
+ */
+void
+kheap_profile(bool on)
+{
+#ifdef LABELS
+	if (on) {
+		kheap_resetprofile();
+	}
+	khprof_on = on;
+#else
+	(void)on;
+	kprintf("Enable LABELS in kmalloc.c to use this functionality.\n");
+#endif
+}
+
+/*
+ * Clear the allocation profile. This starts a new heap generation,
+ * so blocks from before are not counted when freed.
+ */
+void
+kheap_resetprofile(void)
+{
+#ifdef LABELS
+	spinlock_acquire(&kmalloc_spinlock);
+	mallocgeneration++;
+	spinlock_release(&kmalloc_spinlock);
+
+	spinlock_acquire(&khprof_spinlock);
+	khprof_generation = mallocgeneration;
+	bzero(khprof_sites, sizeof(khprof_sites));
+	bzero(khprof_pageallocs, sizeof(khprof_pageallocs));
+	spinlock_release(&khprof_spinlock);
+#endif
+}
+
+/*
+ * Print the N allocation sites holding the most memory.
+ */
+void
+kheap_printprofile(unsigned n)
+{
+#ifdef LABELS
+	struct khprof_site *sites, *ks;
+	bool *shown;
+	unsigned i, j, best;
+	size_t total = 0;
+
+	sites = kmalloc(sizeof(khprof_sites));
+	shown = kmalloc(KHPROF_NSITES * sizeof(shown[0]));
+	if (sites == NULL || shown == NULL) {
+		kfree(sites);
+		kfree(shown);
+		kprintf("kheap_printprofile: Out of memory\n");
+		return;
+	}
+
+	spinlock_acquire(&khprof_spinlock);
+	memcpy(sites, khprof_sites, sizeof(khprof_sites));
+	spinlock_release(&khprof_spinlock);
+
+	for (i=0; i<KHPROF_NSITES; i++) {
+		shown[i] = sites[i].ks_nallocs == 0 && sites[i].ks_nfrees == 0;
+		total += sites[i].ks_livebytes;
+	}
+
+	kprintf("Allocation profile (%s), %lu bytes live:\n",
+		khprof_on ? "on" : "off", (unsigned long)total);
+	kprintf("  %-10s %10s %8s %8s\n", "site", "live", "allocs", "frees");
+	for (i=0; i<n; i++) {
+		/* pick the biggest one not printed yet */
+		best = KHPROF_NSITES;
+		for (j=0; j<KHPROF_NSITES; j++) {
+			if (!shown[j] && (best == KHPROF_NSITES ||
+			    sites[j].ks_livebytes > sites[best].ks_livebytes)) {
+				best = j;
+			}
+		}
+		if (best == KHPROF_NSITES) {
+			break;
+		}
+		shown[best] = true;
+		ks = &sites[best];
+		if (ks->ks_label == 0) {
+			kprintf("  %-10s", "(other)");
+		}
+		else {
+			kprintf("  0x%08lx", (unsigned long)ks->ks_label);
+		}
+		kprintf(" %10lu %8u %8u\n", (unsigned long)ks->ks_livebytes,
+			ks->ks_nallocs, ks->ks_nfrees);
+	}
+
+	kfree(sites);
+	kfree(shown);
+#else
+	(void)n;
+	kprintf("Enable LABELS in kmalloc.c to use this functionality.\n");
+#endif
+}
+
 void
 kheap_nextgeneration(void)
 {
@@ -794,6 +1122,216 @@ subpage_stats(struct pageref *pr)
 	kprintf("\n");
 }
 
+////////////////////////////////////////
+
+#ifdef SIZEHIST
+
+/* Most size classes kheap_printsizes will suggest. */
+#define MAXFITSIZES 12
+
+/*
+ * Choose up to MAXFITSIZES size classes, the last of them
+ * LARGEST_SUBPAGE_SIZE, that waste the least space on the allocations
+ * in HIST, and put them in FIT. Returns how many were chosen, or 0 if
+ * out of memory.
+ *
+ * Only sizes that were actually allocated are worth making classes
+ * of. Over those candidates, best[k][j] is the least space the
+ * allocations up to candidate j can take in k+1 classes of which
+ * the largest is candidate j; it is built up from best[k-1] in the
+ * usual dynamic-programming way.
+ */
+static
+unsigned
+fitsizes(const unsigned *hist, size_t *fit)
+{
+	unsigned *cand, *below;
+	uint64_t *best, cost;
+	uint16_t *from;
+	unsigned ncand, nfit, i, j, k, total;
+
+	/* Too big for the stack; so are best and from. */
+	cand = kmalloc(NSIZEUNITS * sizeof(cand[0]));
+	below = kmalloc(NSIZEUNITS * sizeof(below[0]));
+	if (cand == NULL || below == NULL) {
+		kfree(cand);
+		kfree(below);
+		return 0;
+	}
+
+	ncand = 0;
+	total = 0;
+	for (i=0; i<NSIZEUNITS; i++) {
+		total += hist[i];
+		if ((hist[i] > 0 && i > 0) || i == NSIZEUNITS-1) {
+			cand[ncand] = i;
+			below[ncand] = total;
+			ncand++;
+		}
+	}
+	nfit = ncand < MAXFITSIZES ? ncand : MAXFITSIZES;
+
+	best = kmalloc(nfit * ncand * sizeof(best[0]));
+	from = kmalloc(nfit * ncand * sizeof(from[0]));
+	if (best == NULL || from == NULL) {
+		kfree(best);
+		kfree(from);
+		kfree(cand);
+		kfree(below);
+		return 0;
+	}
+#define BEST(k, j) best[(k) * ncand + (j)]
+#define FROM(k, j) from[(k) * ncand + (j)]
+
+	for (j=0; j<ncand; j++) {
+		BEST(0, j) = (uint64_t)below[j] * cand[j] * SIZEUNIT;
+		FROM(0, j) = j;
+	}
+	for (k=1; k<nfit; k++) {
+		for (j=0; j<ncand; j++) {
+			/* Not enough candidates below j for k+1 classes */
+			BEST(k, j) = BEST(k-1, j);
+			FROM(k, j) = j;
+			for (i=k-1; i<j; i++) {
+				cost = BEST(k-1, i) + (uint64_t)
+					(below[j] - below[i]) *
+					cand[j] * SIZEUNIT;
+				if (cost < BEST(k, j)) {
+					BEST(k, j) = cost;
+					FROM(k, j) = i;
+				}
+			}
+		}
+	}
+
+	/* Walk back from the largest class to get the chosen ones. */
+	i = 0;
+	j = ncand - 1;
+	for (k=nfit; k-- > 0; ) {
+		fit[i++] = cand[j] * SIZEUNIT;
+		if (FROM(k, j) == j) {
+			break;
+		}
+		j = FROM(k, j);
+	}
+#undef BEST
+#undef FROM
+	kfree(best);
+	kfree(from);
+	kfree(cand);
+	kfree(below);
+
+	/* They came out largest first. */
+	for (j=0; j<i/2; j++) {
+		size_t tmp = fit[j];
+		fit[j] = fit[i-1-j];
+		fit[i-1-j] = tmp;
+	}
+	return i;
+}
+
+/*
+ * Space HIST's allocations take in the classes in CLASSES.
+ */
+static
+uint64_t
+sizesused(const unsigned *hist, const size_t *classes, unsigned nclasses)
+{
+	uint64_t used = 0;
+	unsigned i, c = 0;
+
+	for (i=0; i<NSIZEUNITS; i++) {
+		while (classes[c] < i * SIZEUNIT) {
+			c++;
+		}
+		used += (uint64_t)hist[i] * classes[c];
+	}
+	KASSERT(c < nclasses);
+	return used;
+}
+
+#endif /* SIZEHIST */
+
+/*
+ * Print the sizes of the subpage allocations made so far, and the
+ * size classes that would fit them best, in the form kmalloc_sizes.h
+ * wants.
+ */
+void
+kheap_printsizes(void)
+{
+#ifdef SIZEHIST
+	unsigned *hist;
+	size_t fit[MAXFITSIZES];
+	uint64_t asked, used, fitused;
+	unsigned i, n, total;
+
+	/* This runs on a kernel stack, which hist would overflow. */
+	hist = kmalloc(sizeof(sizehist));
+	if (hist == NULL) {
+		kprintf("kheap_printsizes: Out of memory\n");
+		return;
+	}
+	spinlock_acquire(&kmalloc_spinlock);
+	memcpy(hist, sizehist, sizeof(sizehist));
+	spinlock_release(&kmalloc_spinlock);
+
+	kprintf("Subpage allocation sizes:\n");
+	total = 0;
+	asked = 0;
+	for (i=0; i<NSIZEUNITS; i++) {
+		if (hist[i] > 0) {
+			kprintf("  <= %4u: %u\n", i * SIZEUNIT, hist[i]);
+			total += hist[i];
+			asked += (uint64_t)hist[i] * i * SIZEUNIT;
+		}
+	}
+	if (total == 0) {
+		kprintf("  none\n");
+		kfree(hist);
+		return;
+	}
+
+	n = fitsizes(hist, fit);
+	if (n == 0) {
+		kprintf("kheap_printsizes: Out of memory\n");
+		kfree(hist);
+		return;
+	}
+	used = sizesused(hist, sizes, NSIZES);
+	fitused = sizesused(hist, fit, n);
+
+	kprintf("%u allocations asking for %llu bytes took %llu with the "
+		"current classes and would take %llu with these:\n\n",
+		total, asked, used, fitused);
+	kprintf("#define KMALLOC_NSIZES %u\n", n);
+	kprintf("#define KMALLOC_SMALLEST %lu\n", (unsigned long)fit[0]);
+	kprintf("#define KMALLOC_SIZES");
+	for (i=0; i<n; i++) {
+		kprintf(" %lu%s", (unsigned long)fit[i], i < n-1 ? "," : "");
+	}
+	kprintf("\n");
+	kfree(hist);
+#else
+	kprintf("Enable SIZEHIST in kmalloc.c to use this functionality.\n");
+#endif
+}
+
+/*
+ * Start recording allocation sizes over again.
+ */
+void
+kheap_clearsizes(void)
+{
+#ifdef SIZEHIST
+	spinlock_acquire(&kmalloc_spinlock);
+	bzero(sizehist, sizeof(sizehist));
+	spinlock_release(&kmalloc_spinlock);
+#endif
+}
+
+static void kmem_cache_stats(void);
+
 /*
  * Print the whole heap.
  */
@@ -811,6 +1349,8 @@ kheap_printstats(void)
 		subpage_stats(pr);
 	}
 
+	kmem_cache_stats();
+
 	spinlock_release(&kmalloc_spinlock);
 }
 
@@ -844,6 +1384,31 @@ remove_lists(struct pageref *pr, int blktype)
 	}
 }
 
+/*
+ * Fill in blocktypes[].
+ */
+static
+void
+blocktypes_init(void)
+{
+	unsigned i, blktype;
+
+	KASSERT(sizes[NSIZES-1] == LARGEST_SUBPAGE_SIZE);
+	for (i=0; i<NSIZES; i++) {
+		KASSERT(sizes[i] % SIZEUNIT == 0);
+		KASSERT(i == 0 || sizes[i] > sizes[i-1]);
+	}
+
+	blktype = 0;
+	for (i=0; i<NSIZEUNITS; i++) {
+		while (sizes[blktype] < i * SIZEUNIT) {
+			blktype++;
+		}
+		blocktypes[i] = blktype;
+	}
+	blocktypes_ready = true;
+}
+
 /*
  * Given a requested client size, return the block type, that is, the
  * index into the sizes[] array for the block size to use.
@@ -852,33 +1417,50 @@ static
 inline
 int blocktype(size_t clientsz)
 {
-	unsigned i;
-	for (i=0; i<NSIZES; i++) {
-		if (clientsz <= sizes[i]) {
-			return i;
-		}
+	if (clientsz > LARGEST_SUBPAGE_SIZE) {
+		panic("Subpage allocator cannot handle allocation "
+		      "of size %zu\n", clientsz);
 	}
+	if (!blocktypes_ready) {
+		blocktypes_init();
+	}
+	return blocktypes[DIVROUNDUP(clientsz, SIZEUNIT)];
+}
 
-	panic("Subpage allocator cannot handle allocation of size %zu\n",
-	      clientsz);
+/*
+ * Find the pageref of the heap page holding PTRADDR, or NULL if it is
+ * not on one. Call with kmalloc_spinlock held.
+ */
+static
+struct pageref *
+findpageref(vaddr_t ptraddr)
+{
+	struct pageref *pr;
 
-	// keep compiler happy
-	return 0;
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	if (PAGEREF_INDEX(ptraddr) < TOTAL_PAGEREFS) {
+		return pagerefs_bypage[PAGEREF_INDEX(ptraddr)];
+	}
+	for (pr = allbase; pr; pr = pr->next_all) {
+		if (ptraddr >= PR_PAGEADDR(pr) &&
+		    ptraddr < PR_PAGEADDR(pr) + PAGE_SIZE) {
+			return pr;
+		}
+	}
+	return NULL;
 }
 
 /*
- * Allocate a block of size SZ, where SZ is not large enough to
- * warrant a whole-page allocation.
+ * Take a free block of type BLKTYPE off one of the heap pages, making
+ * a new page if none has one. Called with kmalloc_spinlock held and
+ * returns with it held, but drops it to get a page. Returns NULL if
+ * out of memory.
  */
 static
 void *
-subpage_kmalloc(size_t sz
-#ifdef LABELS
-		, vaddr_t label
-#endif
-	)
+subpage_takeblock(unsigned blktype)
 {
-	unsigned blktype;	// index into sizes[] that we're using
 	struct pageref *pr;	// pageref for page we're allocating from
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
 	vaddr_t fla;		// free list entry address
@@ -887,27 +1469,7 @@ subpage_kmalloc(size_t sz
 
 	volatile int i;
 
-#ifdef GUARDS
-	size_t clientsz;
-#endif
-
-#ifdef GUARDS
-	clientsz = sz;
-	sz += GUARD_OVERHEAD;
-#endif
-#ifdef LABELS
-#ifdef GUARDS
-	/* Include the label in what GUARDS considers the client data. */
-	clientsz += LABEL_PTROFFSET;
-#endif
-	sz += LABEL_PTROFFSET;
-#endif
-	blktype = blocktype(sz);
-	sz = sizes[blktype];
-
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
 
 	for (pr = sizebases[blktype]; pr != NULL; pr = pr->next_samesize) {
 
@@ -938,16 +1500,7 @@ subpage_kmalloc(size_t sz
 				KASSERT(pr->nfree == 0);
 				pr->freelist_offset = INVALID_OFFSET;
 			}
-#ifdef GUARDS
-			retptr = establishguardband(retptr, clientsz, sz);
-#endif
-#ifdef LABELS
-			retptr = establishlabel(retptr, label);
-#endif
-
-			checksubpages();
 
-			spinlock_release(&kmalloc_spinlock);
 			return retptr;
 		}
 	}
@@ -966,6 +1519,7 @@ subpage_kmalloc(size_t sz
 	if (prpage==0) {
 		/* Out of memory. */
 		kprintf("kmalloc: Subpage allocator couldn't get a page\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 	KASSERT(prpage % PAGE_SIZE == 0);
@@ -981,6 +1535,7 @@ subpage_kmalloc(size_t sz
 		spinlock_release(&kmalloc_spinlock);
 		free_kpages(prpage);
 		kprintf("kmalloc: Subpage allocator couldn't get pageref\n");
+		spinlock_acquire(&kmalloc_spinlock);
 		return NULL;
 	}
 
@@ -1011,10 +1566,313 @@ subpage_kmalloc(size_t sz
 	pr->next_all = allbase;
 	allbase = pr;
 
+	if (PAGEREF_INDEX(prpage) < TOTAL_PAGEREFS) {
+		pagerefs_bypage[PAGEREF_INDEX(prpage)] = pr;
+	}
+
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
 }
 
+/*
+ * Put the block at PTRADDR back on its page PR. Call with
+ * kmalloc_spinlock held. If that leaves the page with no blocks in
+ * use, it is taken off the lists and its address is returned; the
+ * caller must give it to free_kpages after releasing the lock.
+ * Otherwise returns 0.
+ */
+static
+vaddr_t
+subpage_putblock(struct pageref *pr, vaddr_t ptraddr)
+{
+	int blktype;		// index into sizes[] that we're using
+	vaddr_t prpage;		// PR_PAGEADDR(pr)
+	vaddr_t fla;		// free list entry address
+	struct freelist *fl;	// free list entry
+	vaddr_t offset;		// offset into page
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	offset = ptraddr - prpage;
+
+	/* check for corruption */
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	checksubpage(pr);
+
+	/*
+	 * We probably ought to check for free twice by seeing if the block
+	 * is already on the free list. But that's expensive, so we don't.
+	 */
+
+	fla = prpage + offset;
+	fl = (struct freelist *)fla;
+	if (pr->freelist_offset == INVALID_OFFSET) {
+		fl->next = NULL;
+	} else {
+		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
+
+		/* this block should not already be on the free list! */
+#ifdef SLOW
+		{
+			struct freelist *fl2;
+
+			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
+				KASSERT(fl2 != fl);
+			}
+		}
+#else
+		/* check just the head */
+		KASSERT(fl != fl->next);
+#endif
+	}
+	pr->freelist_offset = offset;
+	pr->nfree++;
+
+	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
+	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
+		/* Whole page is free. */
+		if (PAGEREF_INDEX(prpage) < TOTAL_PAGEREFS) {
+			pagerefs_bypage[PAGEREF_INDEX(prpage)] = NULL;
+		}
+		remove_lists(pr, blktype);
+		freepageref(pr);
+		return prpage;
+	}
+	return 0;
+}
+
+////////////////////////////////////////
+
+#ifdef MAGAZINES
+
+/*
+ * A magazine holds up to MAG_ROUNDS free blocks of one size, as a
+ * stack. It is only touched by its own cpu with interrupts off, so it
+ * needs no lock. When it runs empty or full, MAG_BATCH blocks are
+ * moved between it and the pages under kmalloc_spinlock.
+ */
+#define MAG_ROUNDS 16
+#define MAG_BATCH (MAG_ROUNDS / 2)
+
+struct magazine {
+	unsigned nrounds;
+	vaddr_t rounds[MAG_ROUNDS];
+};
+
+static struct magazine magazines[MAXCPUS][NSIZES];
+
+/*
+ * Give the blocks in BLOCKS back to their pages, freeing any page
+ * that ends up empty.
+ */
+static
+void
+mag_putblocks(const vaddr_t *blocks, unsigned n)
+{
+	vaddr_t freepages[MAG_ROUNDS];
+	unsigned i, nfreepages = 0;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	for (i=0; i<n; i++) {
+		freepages[nfreepages] = subpage_putblock(
+			findpageref(blocks[i]), blocks[i]);
+		if (freepages[nfreepages] != 0) {
+			nfreepages++;
+		}
+	}
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+
+	/* Call free_kpages without kmalloc_spinlock. */
+	for (i=0; i<nfreepages; i++) {
+		free_kpages(freepages[i]);
+	}
+}
+
+/*
+ * This cpu's magazine of type BLKTYPE is empty: get a batch of blocks
+ * from the pages, keep one for the caller, and load the rest. Called
+ * with interrupts on, since getting a fresh page may sleep. Returns
+ * NULL if out of memory.
+ */
+static
+void *
+mag_refill(unsigned blktype)
+{
+	vaddr_t blocks[MAG_BATCH];
+	struct magazine *mag;
+	unsigned n, extra;
+	int spl;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	for (n=0; n<MAG_BATCH; n++) {
+		blocks[n] = (vaddr_t)subpage_takeblock(blktype);
+		if (blocks[n] == 0) {
+			break;
+		}
+	}
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+
+	if (n == 0) {
+		return NULL;
+	}
+
+	/* We may be on another cpu by now, and its magazine may not be empty. */
+	spl = splhigh();
+	mag = &magazines[curcpu->c_number][blktype];
+	for (extra = n-1; extra > 0 && mag->nrounds < MAG_ROUNDS; extra--) {
+		mag->rounds[mag->nrounds++] = blocks[extra];
+	}
+	splx(spl);
+
+	if (extra > 0) {
+		mag_putblocks(&blocks[1], extra);
+	}
+	return (void *)blocks[0];
+}
+
+/*
+ * Take a block of type BLKTYPE from this cpu's magazine, refilling it
+ * if need be.
+ */
+static
+void *
+mag_alloc(unsigned blktype)
+{
+	struct magazine *mag;
+	vaddr_t block = 0;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		/* Too early in boot for per-cpu state; use the pages. */
+		spinlock_acquire(&kmalloc_spinlock);
+		checksubpages();
+		block = (vaddr_t)subpage_takeblock(blktype);
+		checksubpages();
+		spinlock_release(&kmalloc_spinlock);
+		return (void *)block;
+	}
+
+	spl = splhigh();
+	mag = &magazines[curcpu->c_number][blktype];
+	if (mag->nrounds > 0) {
+		block = mag->rounds[--mag->nrounds];
+	}
+	splx(spl);
+
+	if (block == 0) {
+		return mag_refill(blktype);
+	}
+	return (void *)block;
+}
+
+/*
+ * Put a block of type BLKTYPE in this cpu's magazine, first sending
+ * a batch back to the pages if it is full.
+ */
+static
+void
+mag_free(unsigned blktype, vaddr_t block)
+{
+	vaddr_t blocks[MAG_BATCH];
+	struct magazine *mag;
+	unsigned n = 0;
+	int spl;
+
+	if (!CURCPU_EXISTS()) {
+		/* As in mag_alloc. */
+		mag_putblocks(&block, 1);
+		return;
+	}
+
+	spl = splhigh();
+	mag = &magazines[curcpu->c_number][blktype];
+	if (mag->nrounds == MAG_ROUNDS) {
+		for (n=0; n<MAG_BATCH; n++) {
+			blocks[n] = mag->rounds[--mag->nrounds];
+		}
+	}
+	mag->rounds[mag->nrounds++] = block;
+	splx(spl);
+
+	if (n > 0) {
+		mag_putblocks(blocks, n);
+	}
+}
+
+#endif /* MAGAZINES */
+
+////////////////////////////////////////
+
+/*
+ * Allocate a block of size SZ, where SZ is not large enough to
+ * warrant a whole-page allocation.
+ */
+static
+void *
+subpage_kmalloc(size_t sz
+#ifdef LABELS
+		, vaddr_t label
+#endif
+	)
+{
+	unsigned blktype;	// index into sizes[] that we're using
+	void *retptr;		// our result
+
+#ifdef GUARDS
+	size_t clientsz;
+#endif
+
+#ifdef GUARDS
+	clientsz = sz;
+	sz += GUARD_OVERHEAD;
+#endif
+#ifdef LABELS
+#ifdef GUARDS
+	/* Include the label in what GUARDS considers the client data. */
+	clientsz += LABEL_PTROFFSET;
+#endif
+	sz += LABEL_PTROFFSET;
+#endif
+#ifdef SIZEHIST
+	spinlock_acquire(&kmalloc_spinlock);
+	sizehist[DIVROUNDUP(sz, SIZEUNIT)]++;
+	spinlock_release(&kmalloc_spinlock);
+#endif
+	blktype = blocktype(sz);
+	sz = sizes[blktype];
+
+#ifdef MAGAZINES
+	retptr = mag_alloc(blktype);
+#else
+	spinlock_acquire(&kmalloc_spinlock);
+	checksubpages();
+	retptr = subpage_takeblock(blktype);
+	checksubpages();
+	spinlock_release(&kmalloc_spinlock);
+#endif
+	if (retptr == NULL) {
+		return NULL;
+	}
+
+#ifdef GUARDS
+	retptr = establishguardband(retptr, clientsz, sz);
+#endif
+#ifdef LABELS
+	retptr = establishlabel(retptr, label);
+	if (khprof_on) {
+		khprof_alloc(label, sz);
+	}
+#endif
+
+	return retptr;
+}
+
 /*
  * Free a pointer previously returned from subpage_kmalloc. If the
  * pointer is not on any heap page we recognize, return -1.
@@ -1027,12 +1885,13 @@ subpage_kfree(void *ptr)
 	vaddr_t ptraddr;	// same as ptr
 	struct pageref *pr;	// pageref for page we're freeing in
 	vaddr_t prpage;		// PR_PAGEADDR(pr)
-	vaddr_t fla;		// free list entry address
-	struct freelist *fl;	// free list entry
 	vaddr_t offset;		// offset into page
 #ifdef GUARDS
 	size_t blocksize, smallerblocksize;
 #endif
+#ifndef MAGAZINES
+	vaddr_t freepage;
+#endif
 
 	ptraddr = (vaddr_t)ptr;
 #ifdef GUARDS
@@ -1059,34 +1918,35 @@ subpage_kfree(void *ptr)
 	ptraddr -= LABEL_PTROFFSET;
 #endif
 
-	spinlock_acquire(&kmalloc_spinlock);
-
-	checksubpages();
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
+	if (PAGEREF_INDEX(ptraddr) < TOTAL_PAGEREFS) {
+		/*
+		 * No lock needed: the page can't go away while the
+		 * caller still has a block on it.
+		 */
+		pr = pagerefs_bypage[PAGEREF_INDEX(ptraddr)];
+	}
+	else {
+		spinlock_acquire(&kmalloc_spinlock);
+		pr = findpageref(ptraddr);
+		spinlock_release(&kmalloc_spinlock);
 	}
-
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
-		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+	KASSERT(blktype >= 0 && blktype < NSIZES);
 	offset = ptraddr - prpage;
 
-	/* Check for proper positioning and alignment */
-	if (offset >= PAGE_SIZE || offset % sizes[blktype] != 0) {
+	/*
+	 * Check for proper positioning and alignment. Block sizes
+	 * need not divide the page, so there may be a tail at the
+	 * end that isn't a block.
+	 */
+	if (offset >= (PAGE_SIZE / sizes[blktype]) * sizes[blktype] ||
+	    offset % sizes[blktype] != 0) {
 		panic("kfree: subpage free of invalid addr %p\n", ptr);
 	}
 
@@ -1095,6 +1955,10 @@ subpage_kfree(void *ptr)
 	smallerblocksize = blktype > 0 ? sizes[blktype - 1] : 0;
 	checkguardband(ptraddr, smallerblocksize, blocksize);
 #endif
+#ifdef LABELS
+	khprof_subpagefree((struct malloclabel *)
+			   ((vaddr_t)ptr - LABEL_PTROFFSET), sizes[blktype]);
+#endif
 
 	/*
 	 * Clear the block to 0xdeadbeef to make it easier to detect
@@ -1102,52 +1966,19 @@ subpage_kfree(void *ptr)
 	 */
 	fill_deadbeef((void *)ptraddr, sizes[blktype]);
 
-	/*
-	 * We probably ought to check for free twice by seeing if the block
-	 * is already on the free list. But that's expensive, so we don't.
-	 */
-
-	fla = prpage + offset;
-	fl = (struct freelist *)fla;
-	if (pr->freelist_offset == INVALID_OFFSET) {
-		fl->next = NULL;
-	} else {
-		fl->next = (struct freelist *)(prpage + pr->freelist_offset);
-
-		/* this block should not already be on the free list! */
-#ifdef SLOW
-		{
-			struct freelist *fl2;
-
-			for (fl2 = fl->next; fl2 != NULL; fl2 = fl2->next) {
-				KASSERT(fl2 != fl);
-			}
-		}
+#ifdef MAGAZINES
+	mag_free(blktype, ptraddr);
 #else
-		/* check just the head */
-		KASSERT(fl != fl->next);
-#endif
-	}
-	pr->freelist_offset = offset;
-	pr->nfree++;
-
-	KASSERT(pr->nfree <= PAGE_SIZE / sizes[blktype]);
-	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
-		/* Whole page is free. */
-		remove_lists(pr, blktype);
-		freepageref(pr);
-		/* Call free_kpages without kmalloc_spinlock. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(prpage);
-	}
-	else {
-		spinlock_release(&kmalloc_spinlock);
-	}
-
-#ifdef SLOWER /* Don't get the lock unless checksubpages does something. */
 	spinlock_acquire(&kmalloc_spinlock);
 	checksubpages();
+	freepage = subpage_putblock(pr, ptraddr);
+	checksubpages();
 	spinlock_release(&kmalloc_spinlock);
+
+	if (freepage != 0) {
+		/* Call free_kpages without kmalloc_spinlock. */
+		free_kpages(freepage);
+	}
 #endif
 
 	return 0;
@@ -1157,25 +1988,31 @@ subpage_kfree(void *ptr)
 ////////////////////////////////////////////////////////////
 
 /*
- * Allocate a block of size SZ. Redirect either to subpage_kmalloc or
- * alloc_kpages depending on how big SZ is.
+ * The allocation site to label a block with: where the function
+ * using this macro was called from.
  */
-void *
-kmalloc(size_t sz)
-{
-	size_t checksz;
-#ifdef LABELS
-	vaddr_t label;
-#endif
-
 #ifdef LABELS
 #ifdef __GNUC__
-	label = (vaddr_t)__builtin_return_address(0);
+#define CALLSITE() ((vaddr_t)__builtin_return_address(0))
 #else
 #error "Don't know how to get return address with this compiler"
 #endif /* __GNUC__ */
 #endif /* LABELS */
 
+/*
+ * Allocate a block of size SZ. Redirect either to subpage_kmalloc or
+ * alloc_kpages depending on how big SZ is.
+ */
+static
+void *
+kmalloc_common(size_t sz
+#ifdef LABELS
+	       , vaddr_t label
+#endif
+	)
+{
+	size_t checksz;
+
 	checksz = sz + GUARD_OVERHEAD + LABEL_OVERHEAD;
 	if (checksz >= LARGEST_SUBPAGE_SIZE) {
 		unsigned long npages;
@@ -1188,6 +2025,9 @@ kmalloc(size_t sz)
 			return NULL;
 		}
 		KASSERT(address % PAGE_SIZE == 0);
+#ifdef LABELS
+		khprof_pagealloc(label, address, npages * PAGE_SIZE);
+#endif
 
 		return (void *)address;
 	}
@@ -1199,6 +2039,16 @@ kmalloc(size_t sz)
 #endif
 }
 
+void *
+kmalloc(size_t sz)
+{
+#ifdef LABELS
+	return kmalloc_common(sz, CALLSITE());
+#else
+	return kmalloc_common(sz);
+#endif
+}
+
 /*
  * Free a block previously returned from kmalloc.
  */
@@ -1212,7 +2062,202 @@ kfree(void *ptr)
 		return;
 	} else if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+#ifdef LABELS
+		khprof_pagefree((vaddr_t)ptr);
+#endif
 		free_kpages((vaddr_t)ptr);
 	}
 }
 
+
+////////////////////////////////////////////////////////////
+//
+// Object caches.
+//
+// A cache hands out objects of one type. Objects are built by the
+// cache's constructor when first allocated, and when freed are kept
+// in constructed form (up to KMC_MAXFREE of them) for the next
+// allocation, so their locks, wait channels, stacks and the like
+// don't need to be made over again each time. The destructor is
+// only run when an object really goes back to kmalloc.
+//
+// Memory comes from kmalloc, so the heap debugging checks apply to
+// cached objects as to any others.
+
+#define KMC_MAXFREE 32
+
+struct kmem_cache {
+	const char *kc_name;
+	size_t kc_size;
+	int (*kc_ctor)(void *obj);
+	void (*kc_dtor)(void *obj);
+	struct spinlock kc_lock;
+	unsigned kc_nfree;		/* constructed objects in kc_free */
+	void *kc_free[KMC_MAXFREE];
+
+	/* statistics */
+	unsigned kc_nlive;		/* objects handed out */
+	unsigned kc_nallocs;		/* calls to kmem_cache_alloc */
+	unsigned kc_nhits;		/* ...that got a constructed object */
+
+	struct kmem_cache *kc_next;	/* on kmem_caches */
+};
+
+/* All the caches, for kheap_printstats; protected by kmalloc_spinlock. */
+static struct kmem_cache *kmem_caches;
+
+/*
+ * Create a cache of SIZE-byte objects. CTOR (if not NULL) is called
+ * on each fresh object and returns 0 or an error code; DTOR (if not
+ * NULL) undoes it. NAME is not copied.
+ */
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size,
+		  int (*ctor)(void *obj), void (*dtor)(void *obj))
+{
+	struct kmem_cache *kc;
+
+	kc = kmalloc(sizeof(*kc));
+	if (kc == NULL) {
+		return NULL;
+	}
+	kc->kc_name = name;
+	kc->kc_size = size;
+	kc->kc_ctor = ctor;
+	kc->kc_dtor = dtor;
+	spinlock_init(&kc->kc_lock);
+	kc->kc_nfree = 0;
+	kc->kc_nlive = 0;
+	kc->kc_nallocs = 0;
+	kc->kc_nhits = 0;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	kc->kc_next = kmem_caches;
+	kmem_caches = kc;
+	spinlock_release(&kmalloc_spinlock);
+
+	return kc;
+}
+
+/*
+ * Destroy a cache. All its objects must have been freed.
+ */
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+	struct kmem_cache **kcp;
+
+	KASSERT(kc->kc_nlive == 0);
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (kcp = &kmem_caches; *kcp != kc; kcp = &(*kcp)->kc_next) {
+		KASSERT(*kcp != NULL);
+	}
+	*kcp = kc->kc_next;
+	spinlock_release(&kmalloc_spinlock);
+
+	while (kc->kc_nfree > 0) {
+		kc->kc_nfree--;
+		if (kc->kc_dtor != NULL) {
+			kc->kc_dtor(kc->kc_free[kc->kc_nfree]);
+		}
+		kfree(kc->kc_free[kc->kc_nfree]);
+	}
+	spinlock_cleanup(&kc->kc_lock);
+	kfree(kc);
+}
+
+/*
+ * Get a constructed object from a cache. Returns NULL if out of
+ * memory or if the constructor fails.
+ */
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+	void *obj;
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_nallocs++;
+	if (kc->kc_nfree > 0) {
+		obj = kc->kc_free[--kc->kc_nfree];
+		kc->kc_nhits++;
+		kc->kc_nlive++;
+		spinlock_release(&kc->kc_lock);
+		return obj;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	/*
+	 * Label the object with whoever asked the cache for it, so the
+	 * heap profile tells the caches' users apart.
+	 */
+#ifdef LABELS
+	obj = kmalloc_common(kc->kc_size, CALLSITE());
+#else
+	obj = kmalloc_common(kc->kc_size);
+#endif
+	if (obj == NULL) {
+		return NULL;
+	}
+	if (kc->kc_ctor != NULL && kc->kc_ctor(obj) != 0) {
+		kfree(obj);
+		return NULL;
+	}
+
+	spinlock_acquire(&kc->kc_lock);
+	kc->kc_nlive++;
+	spinlock_release(&kc->kc_lock);
+	return obj;
+}
+
+/*
+ * Give an object back to its cache. It must be in the state the
+ * constructor left it in.
+ */
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+	KASSERT(obj != NULL);
+
+	spinlock_acquire(&kc->kc_lock);
+	KASSERT(kc->kc_nlive > 0);
+	kc->kc_nlive--;
+	if (kc->kc_nfree < KMC_MAXFREE) {
+		kc->kc_free[kc->kc_nfree++] = obj;
+		spinlock_release(&kc->kc_lock);
+		return;
+	}
+	spinlock_release(&kc->kc_lock);
+
+	if (kc->kc_dtor != NULL) {
+		kc->kc_dtor(obj);
+	}
+	kfree(obj);
+}
+
+/*
+ * Print the usage of each cache. Called by kheap_printstats with
+ * kmalloc_spinlock held.
+ */
+static
+void
+kmem_cache_stats(void)
+{
+	struct kmem_cache *kc;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	if (kmem_caches == NULL) {
+		return;
+	}
+	kprintf("Object caches:\n");
+	kprintf("  %-16s %6s %6s %6s %8s %8s\n",
+		"name", "size", "live", "cached", "allocs", "hits");
+	for (kc = kmem_caches; kc != NULL; kc = kc->kc_next) {
+		spinlock_acquire(&kc->kc_lock);
+		kprintf("  %-16s %6lu %6u %6u %8u %8u\n", kc->kc_name,
+			(unsigned long)kc->kc_size, kc->kc_nlive,
+			kc->kc_nfree, kc->kc_nallocs, kc->kc_nhits);
+		spinlock_release(&kc->kc_lock);
+	}
+}
@@ -0,0 +1,21 @@
+/*
+ * Size classes for the kmalloc subpage allocator, used when the
+ * kernel is built with "options kmsizes".
+ *
+ * To fit them to a workload, build with SIZEHIST defined in
+ * kmalloc.c, run the workload (khsizes clear first to skip boot),
+ * and replace the definitions below with what khsizes prints. The
+ * sizes must be multiples of 8 in increasing order, ending at 2048,
+ * and KMALLOC_SMALLEST must be the first of them.
+ *
+ * Until then these are the same as the default classes.
+ */
+
+#ifndef _KMALLOC_SIZES_H_
+#define _KMALLOC_SIZES_H_
+
+#define KMALLOC_NSIZES 8
+#define KMALLOC_SMALLEST 16
+#define KMALLOC_SIZES 16, 32, 64, 128, 256, 512, 1024, 2048
+
+#endif /* _KMALLOC_SIZES_H_ */
@@ -0,0 +1,221 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <vm.h>
+#include <pagecache.h>
+
+#define PC_BUCKETS          16
+#define PC_HASH(offset)     (((offset) / PAGE_SIZE) % PC_BUCKETS)
+
+struct pc_page {
+    off_t pcp_offset;
+    paddr_t pcp_paddr;
+    struct pc_page *pcp_next;
+};
+
+struct pagecache {
+    struct lock *pc_lock;
+    struct pc_page *pc_buckets[PC_BUCKETS];
+    unsigned pc_generation;     /* bumped on every invalidate */
+};
+
+// returns V's cache, creating it on first use; NULL if out of memory
+static struct pagecache *pc_get(struct vnode *v)
+{
+    struct pagecache *pc, *newpc;
+
+    // vn_countlock also guards installing the cache pointer
+    spinlock_acquire(&v->vn_countlock);
+    pc = v->vn_pagecache;
+    spinlock_release(&v->vn_countlock);
+    if (pc != NULL) {
+        return pc;
+    }
+
+    newpc = kmalloc(sizeof(struct pagecache));
+    if (newpc == NULL) {
+        return NULL;
+    }
+    newpc->pc_lock = lock_create("pagecache");
+    if (newpc->pc_lock == NULL) {
+        kfree(newpc);
+        return NULL;
+    }
+    for (int i = 0; i < PC_BUCKETS; i++) {
+        newpc->pc_buckets[i] = NULL;
+    }
+    newpc->pc_generation = 0;
+
+    spinlock_acquire(&v->vn_countlock);
+    if (v->vn_pagecache == NULL) {
+        v->vn_pagecache = newpc;
+    }
+    pc = v->vn_pagecache;
+    spinlock_release(&v->vn_countlock);
+
+    // somebody else got there first
+    if (pc != newpc) {
+        lock_destroy(newpc->pc_lock);
+        kfree(newpc);
+    }
+    return pc;
+}
+
+// caller holds pc_lock
+static struct pc_page *pc_lookup(struct pagecache *pc, off_t offset)
+{
+    struct pc_page *pp;
+
+    for (pp = pc->pc_buckets[PC_HASH(offset)]; pp != NULL; pp = pp->pcp_next) {
+        if (pp->pcp_offset == offset) {
+            return pp;
+        }
+    }
+    return NULL;
+}
+
+int pagecache_getpage(struct vnode *v, off_t offset, paddr_t *ret)
+{
+    struct pagecache *pc;
+    struct pc_page *pp, *other;
+    struct iovec iov;
+    struct uio ku;
+    unsigned generation;
+    paddr_t paddr;
+    int result;
+
+    KASSERT(offset % PAGE_SIZE == 0);
+
+    pc = pc_get(v);
+    if (pc == NULL) {
+        return ENOMEM;
+    }
+
+    lock_acquire(pc->pc_lock);
+    pp = pc_lookup(pc, offset);
+    if (pp != NULL) {
+        coremap_incref(pp->pcp_paddr);
+        *ret = pp->pcp_paddr;
+        lock_release(pc->pc_lock);
+        return 0;
+    }
+    generation = pc->pc_generation;
+    lock_release(pc->pc_lock);
+
+    /*
+     * Read without the cache lock, since the filesystem invalidates
+     * the cache from inside its write path.
+     */
+    paddr = coremap_alloc_shared();
+    if (paddr == 0) {
+        return ENOMEM;
+    }
+    bzero((void *) PADDR_TO_KVADDR(paddr), PAGE_SIZE);
+
+    // a short read at EOF leaves the rest of the page zero
+    uio_kinit(&iov, &ku, (void *) PADDR_TO_KVADDR(paddr), PAGE_SIZE, offset,
+              UIO_READ);
+    result = VOP_READ(v, &ku);
+    if (result) {
+        coremap_release(paddr, NULL);
+        return result;
+    }
+
+    pp = kmalloc(sizeof(struct pc_page));
+
+    lock_acquire(pc->pc_lock);
+    other = pc_lookup(pc, offset);
+    if (other != NULL) {
+        // read in twice at once; use the copy that is already cached
+        coremap_incref(other->pcp_paddr);
+        *ret = other->pcp_paddr;
+        lock_release(pc->pc_lock);
+        coremap_release(paddr, NULL);
+        kfree(pp);
+        return 0;
+    }
+
+    // if the file was written meanwhile the page is only good for this fault
+    if (pp != NULL && generation == pc->pc_generation) {
+        pp->pcp_offset = offset;
+        pp->pcp_paddr = paddr;
+        pp->pcp_next = pc->pc_buckets[PC_HASH(offset)];
+        pc->pc_buckets[PC_HASH(offset)] = pp;
+        coremap_incref(paddr);
+        coremap_setcache(paddr, pc, offset);
+        pp = NULL;
+    }
+    lock_release(pc->pc_lock);
+
+    kfree(pp);
+    *ret = paddr;
+    return 0;
+}
+
+bool pagecache_reclaim(struct pagecache *pc, off_t offset, paddr_t paddr)
+{
+    struct pc_page *pp, **ppp;
+
+    if (!lock_tryacquire(pc->pc_lock)) {
+        return false;
+    }
+    for (ppp = &pc->pc_buckets[PC_HASH(offset)]; *ppp != NULL;
+         ppp = &(*ppp)->pcp_next) {
+        pp = *ppp;
+        if (pp->pcp_offset == offset && pp->pcp_paddr == paddr) {
+            *ppp = pp->pcp_next;
+            lock_release(pc->pc_lock);
+            coremap_setcache(paddr, NULL, 0);
+            kfree(pp);
+            return true;
+        }
+    }
+    lock_release(pc->pc_lock);
+    return false;
+}
+
+void pagecache_invalidate(struct vnode *v)
+{
+    struct pagecache *pc;
+    struct pc_page *pp;
+
+    spinlock_acquire(&v->vn_countlock);
+    pc = v->vn_pagecache;
+    spinlock_release(&v->vn_countlock);
+    if (pc == NULL) {
+        return;
+    }
+
+    lock_acquire(pc->pc_lock);
+    pc->pc_generation++;
+    for (int i = 0; i < PC_BUCKETS; i++) {
+        while (pc->pc_buckets[i] != NULL) {
+            pp = pc->pc_buckets[i];
+            pc->pc_buckets[i] = pp->pcp_next;
+
+            // pages still mapped live on as their mappers' copies
+            coremap_setcache(pp->pcp_paddr, NULL, 0);
+            coremap_release(pp->pcp_paddr, NULL);
+            kfree(pp);
+        }
+    }
+    lock_release(pc->pc_lock);
+}
+
+void pagecache_destroy(struct vnode *v)
+{
+    struct pagecache *pc = v->vn_pagecache;
+
+    if (pc == NULL) {
+        return;
+    }
+
+    pagecache_invalidate(v);
+    lock_destroy(pc->pc_lock);
+    kfree(pc);
+    v->vn_pagecache = NULL;
+}
@@ -0,0 +1,135 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+#include <swap.h>
+
+/*
+ * Create a page table with an empty directory
+ */
+struct pagetable *pt_create(void)
+{
+    struct pagetable *pt;
+
+    pt = kmalloc(sizeof(struct pagetable));
+    if (pt == NULL) {
+        return NULL;
+    }
+
+    for (int i = 0; i < PT_L1_SIZE; i++) {
+        pt->pt_dir[i] = NULL;
+    }
+
+    return pt;
+}
+
+/*
+ * Free every resident page and swap slot, then the second-level tables
+ * and directory
+ */
+void pt_destroy(struct pagetable *pt, struct addrspace *as)
+{
+    KASSERT(pt != NULL);
+
+    for (int i = 0; i < PT_L1_SIZE; i++) {
+        pte_t *l2 = pt->pt_dir[i];
+        if (l2 == NULL) {
+            continue;
+        }
+
+        for (int j = 0; j < PT_L2_SIZE; j++) {
+            if (l2[j] & PTE_VALID) {
+                coremap_release(l2[j] & PTE_FRAME, as);
+            } else if (l2[j] & PTE_SWAPPED) {
+                swap_free(PTE_SLOT(l2[j]));
+            }
+        }
+        kfree(l2);
+    }
+
+    kfree(pt);
+}
+
+void pt_unmap(struct pagetable *pt, struct addrspace *as,
+              vaddr_t start, vaddr_t end)
+{
+    vaddr_t vaddr = start;
+
+    while (vaddr < end) {
+        pte_t *pte = pt_lookup(pt, vaddr, false);
+
+        // nothing was ever touched in this 4M; skip the whole table
+        if (pte == NULL) {
+            vaddr = PT_VADDR(PT_L1_INDEX(vaddr) + 1, 0);
+            continue;
+        }
+
+        if (*pte & PTE_VALID) {
+            coremap_release(*pte & PTE_FRAME, as);
+        } else if (*pte & PTE_SWAPPED) {
+            swap_free(PTE_SLOT(*pte));
+        }
+        *pte = 0;
+        vaddr += PAGE_SIZE;
+    }
+}
+
+pte_t *pt_lookup(struct pagetable *pt, vaddr_t vaddr, bool create)
+{
+    pte_t *l2 = pt->pt_dir[PT_L1_INDEX(vaddr)];
+
+    if (l2 == NULL) {
+        if (!create) {
+            return NULL;
+        }
+
+        // second-level tables are exactly one page
+        l2 = kmalloc(PT_L2_SIZE * sizeof(pte_t));
+        if (l2 == NULL) {
+            return NULL;
+        }
+        bzero(l2, PT_L2_SIZE * sizeof(pte_t));
+        pt->pt_dir[PT_L1_INDEX(vaddr)] = l2;
+    }
+
+    return &l2[PT_L2_INDEX(vaddr)];
+}
+
+/*
+ * Share every resident page of old with new, copy-on-write, and every
+ * swapped-out page's slot.
+ * On failure, whatever was copied stays in new for pt_destroy.
+ */
+int pt_copy(struct pagetable *old, struct pagetable *new)
+{
+    for (int i = 0; i < PT_L1_SIZE; i++) {
+        pte_t *old_l2 = old->pt_dir[i];
+        if (old_l2 == NULL) {
+            continue;
+        }
+
+        for (int j = 0; j < PT_L2_SIZE; j++) {
+            if (!(old_l2[j] & (PTE_VALID | PTE_SWAPPED))) {
+                continue;
+            }
+
+            pte_t *pte = pt_lookup(new, PT_VADDR(i, j), true);
+            if (pte == NULL) {
+                return ENOMEM;
+            }
+
+            // allocating may have paged the old entry out, so look again
+            if (old_l2[j] & PTE_VALID) {
+                old_l2[j] |= PTE_COW;
+                *pte = old_l2[j];
+                coremap_incref(old_l2[j] & PTE_FRAME);
+            } else if (old_l2[j] & PTE_SWAPPED) {
+                *pte = old_l2[j];
+                swap_incref(PTE_SLOT(old_l2[j]));
+            }
+        }
+    }
+
+    return 0;
+}
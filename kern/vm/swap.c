@@ -0,0 +1,146 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <bitmap.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <kern/vmstat.h>
+#include <vm.h>
+#include <swap.h>
+
+static struct vnode *swap_vnode;
+static struct bitmap *swap_map;         /* one bit per slot, set if used */
+static unsigned *swap_refs;             /* references to each used slot */
+static unsigned swap_nslots;
+static unsigned swap_nused;
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+
+void swap_bootstrap(void)
+{
+    char path[] = SWAP_DEVICE;
+    struct stat st;
+    int result;
+
+    result = vfs_open(path, O_RDWR, 0, &swap_vnode);
+    if (result) {
+        kprintf("swap: %s: %s; paging disabled\n", SWAP_DEVICE,
+                strerror(result));
+        swap_vnode = NULL;
+        return;
+    }
+
+    result = VOP_STAT(swap_vnode, &st);
+    if (result) {
+        panic("swap: stat of %s failed: %s\n", SWAP_DEVICE, strerror(result));
+    }
+
+    swap_nslots = st.st_size / PAGE_SIZE;
+    swap_map = bitmap_create(swap_nslots);
+    if (swap_map == NULL) {
+        panic("swap: out of memory for %u slot bitmap\n", swap_nslots);
+    }
+    swap_refs = kmalloc(swap_nslots * sizeof(unsigned));
+    if (swap_refs == NULL) {
+        panic("swap: out of memory for %u slot counts\n", swap_nslots);
+    }
+
+    kprintf("swap: %uk on %s\n", swap_nslots * PAGE_SIZE / 1024, SWAP_DEVICE);
+}
+
+bool swap_enabled(void)
+{
+    return swap_vnode != NULL;
+}
+
+int swap_alloc(unsigned *slot)
+{
+    int result;
+
+    if (swap_map == NULL) {
+        return ENOSPC;
+    }
+
+    spinlock_acquire(&swap_lock);
+    result = bitmap_alloc(swap_map, slot);
+    if (result == 0) {
+        swap_refs[*slot] = 1;
+        swap_nused++;
+    }
+    spinlock_release(&swap_lock);
+
+    return result;
+}
+
+void swap_incref(unsigned slot)
+{
+    KASSERT(slot < swap_nslots);
+
+    spinlock_acquire(&swap_lock);
+    KASSERT(swap_refs[slot] > 0);
+    swap_refs[slot]++;
+    spinlock_release(&swap_lock);
+}
+
+void swap_free(unsigned slot)
+{
+    KASSERT(slot < swap_nslots);
+
+    spinlock_acquire(&swap_lock);
+    KASSERT(swap_refs[slot] > 0);
+    if (--swap_refs[slot] == 0) {
+        bitmap_unmark(swap_map, slot);
+        swap_nused--;
+    }
+    spinlock_release(&swap_lock);
+}
+
+void swap_usage(unsigned *nslots, unsigned *nused)
+{
+    spinlock_acquire(&swap_lock);
+    *nslots = swap_nslots;
+    *nused = swap_nused;
+    spinlock_release(&swap_lock);
+}
+
+/*
+ * Move one page between memory and its slot on the swap disk
+ */
+static int swap_io(paddr_t paddr, unsigned slot, enum uio_rw rw)
+{
+    struct iovec iov;
+    struct uio ku;
+    int result;
+
+    KASSERT(slot < swap_nslots);
+
+    uio_kinit(&iov, &ku, (void *) PADDR_TO_KVADDR(paddr), PAGE_SIZE,
+              (off_t) slot * PAGE_SIZE, rw);
+    if (rw == UIO_READ) {
+        result = VOP_READ(swap_vnode, &ku);
+    } else {
+        result = VOP_WRITE(swap_vnode, &ku);
+    }
+    if (result) {
+        return result;
+    }
+
+    // the disk is a whole number of pages, so this never happens
+    KASSERT(ku.uio_resid == 0);
+    return 0;
+}
+
+int swap_out(paddr_t paddr, unsigned slot)
+{
+    vmstat_inc(VMS_SWAPOUT);
+    return swap_io(paddr, slot, UIO_WRITE);
+}
+
+int swap_in(unsigned slot, paddr_t paddr)
+{
+    vmstat_inc(VMS_SWAPIN);
+    return swap_io(paddr, slot, UIO_READ);
+}
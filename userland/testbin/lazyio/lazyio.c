@@ -0,0 +1,100 @@
+/*
+ * lazyio - read() and write() with buffers on pages not yet loaded.
+ *
+ * Program pages are only read in from the executable when first
+ * touched. Here the first touch of several pages is by the kernel,
+ * copying a write() from read-only data and a read() into initialized
+ * data, so the page has to be faulted in from the executable while
+ * the file system is busy with the transfer. Run it from the same
+ * file system as the file it writes (the default, emu0:) to make the
+ * fault land on the device doing the I/O.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#define PAGE_SIZE 4096
+
+#define FILENAME "lazyio.dat"
+#define NPAGES 4
+
+/*
+ * Both arrays span several pages that nothing else in the program
+ * touches, and neither is all zeros, so they stay out of the bss.
+ */
+static const char textdata[NPAGES * PAGE_SIZE] = { 'l', 'a', 'z', 'y' };
+static char databuf[NPAGES * PAGE_SIZE] = { 1 };
+
+/* sizeof, not strlen, so only write() reads it */
+static const char literal[] = "lazyio: a string literal, read-only too\n";
+
+static
+void
+checkwrite(int fd, const void *buf, size_t len, const char *what)
+{
+	ssize_t r;
+
+	r = write(fd, buf, len);
+	if (r < 0) {
+		err(1, "write from %s", what);
+	}
+	if ((size_t)r != len) {
+		errx(1, "write from %s: short count %ld", what, (long)r);
+	}
+}
+
+int
+main(void)
+{
+	size_t litlen, total;
+	ssize_t r;
+	int fd;
+
+	litlen = sizeof(literal) - 1;
+	total = litlen + (NPAGES - 1) * PAGE_SIZE;
+
+	printf("lazyio: writing from untouched read-only pages\n");
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open for write", FILENAME);
+	}
+	checkwrite(fd, literal, litlen, "a string literal");
+	checkwrite(fd, textdata + PAGE_SIZE, (NPAGES - 1) * PAGE_SIZE,
+		   "constant data");
+	close(fd);
+
+	printf("lazyio: reading into untouched data pages\n");
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open for read", FILENAME);
+	}
+	r = read(fd, databuf + PAGE_SIZE / 2, total);
+	if (r < 0) {
+		err(1, "read into initialized data");
+	}
+	if ((size_t)r != total) {
+		errx(1, "read: short count %ld of %lu", (long)r,
+		     (unsigned long)total);
+	}
+	close(fd);
+
+	if (memcmp(databuf + PAGE_SIZE / 2, literal, litlen) != 0) {
+		errx(1, "string literal came back wrong");
+	}
+	if (memcmp(databuf + PAGE_SIZE / 2 + litlen, textdata + PAGE_SIZE,
+		   (NPAGES - 1) * PAGE_SIZE) != 0) {
+		errx(1, "constant data came back wrong");
+	}
+	if (databuf[0] != 1) {
+		errx(1, "initialized data before the buffer changed");
+	}
+
+	if (remove(FILENAME) < 0) {
+		err(1, "%s: remove", FILENAME);
+	}
+	printf("lazyio: passed\n");
+	return 0;
+}
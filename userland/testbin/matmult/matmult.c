@@ -57,6 +57,7 @@ int
 main(void)
 {
     int i, j, k, r;
+    struct vmstat vs;
 
     for (i = 0; i < Dim; i++)		/* first initialize the matrices */
 	for (j = 0; j < Dim; j++) {
@@ -81,6 +82,10 @@ main(void)
 
     printf("matmult finished.\n");
     printf("answer is: %d (should be %d)\n", r, RIGHT);
+    if (vmstat(&vs) == 0) {
+	    printf("%u TLB misses, %u replacing a valid entry\n",
+		   vs.vms_tlbmisses, vs.vms_tlbevictions);
+    }
     if (r != RIGHT) {
 	    printf("FAILED\n");
 	    return 1;
@@ -0,0 +1,387 @@
+/*
+ * mmaptest - check mmap(), munmap() and the page cache behind them.
+ *
+ * Writes a file a few pages long, then checks that mappings of it
+ * read the same bytes as read(), that writes to a private mapping
+ * stay out of the file, that munmap only takes whole mappings, and
+ * that mmap and madvise reject bad arguments. vmstat() is used to
+ * confirm the pages really came through the page cache.
+ *
+ * The file is left behind if a check fails, for inspection.
+ */
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+
+#define PAGE_SIZE 4096
+
+#define FILENAME "mmaptest.dat"
+#define FILESIZE (3 * PAGE_SIZE + 100)  /* last page only partly used */
+
+static char filedata[FILESIZE];
+static char readback[FILESIZE];
+
+static
+char
+pattern(unsigned i)
+{
+	return (char)(i * 7 + i / PAGE_SIZE);
+}
+
+static
+void
+readfile(char *buf)
+{
+	int fd;
+	ssize_t r;
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open for read", FILENAME);
+	}
+	r = read(fd, buf, FILESIZE);
+	if (r < 0) {
+		err(1, "%s: read", FILENAME);
+	}
+	if (r != FILESIZE) {
+		errx(1, "%s: short read (%ld of %d)", FILENAME, (long)r,
+		     FILESIZE);
+	}
+	close(fd);
+}
+
+static
+void
+makefile(void)
+{
+	unsigned i;
+	ssize_t r;
+	int fd;
+
+	for (i=0; i<FILESIZE; i++) {
+		filedata[i] = pattern(i);
+	}
+
+	fd = open(FILENAME, O_WRONLY|O_CREAT|O_TRUNC, 0664);
+	if (fd < 0) {
+		err(1, "%s: open for write", FILENAME);
+	}
+	r = write(fd, filedata, FILESIZE);
+	if (r < 0) {
+		err(1, "%s: write", FILENAME);
+	}
+	if (r != FILESIZE) {
+		errx(1, "%s: short write (%ld of %d)", FILENAME, (long)r,
+		     FILESIZE);
+	}
+	close(fd);
+
+	readfile(readback);
+	if (memcmp(readback, filedata, FILESIZE) != 0) {
+		errx(1, "%s: read back the wrong data", FILENAME);
+	}
+}
+
+static
+char *
+mapfile(int fd, int prot, int flags)
+{
+	void *p;
+
+	p = mmap(NULL, FILESIZE, prot, flags, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	return p;
+}
+
+static
+void
+unmapfile(char *p)
+{
+	if (munmap(p, FILESIZE) < 0) {
+		err(1, "munmap");
+	}
+}
+
+/*
+ * The mapping must show the same bytes read() does, and zeros from
+ * the end of the file to the end of the last page.
+ */
+static
+void
+checkmapping(const char *what, const char *p)
+{
+	unsigned i;
+
+	for (i=0; i<FILESIZE; i++) {
+		if (p[i] != readback[i]) {
+			errx(1, "%s: byte %u is 0x%x, read() gave 0x%x",
+			     what, i, (unsigned char)p[i],
+			     (unsigned char)readback[i]);
+		}
+	}
+	for (; i % PAGE_SIZE != 0; i++) {
+		if (p[i] != 0) {
+			errx(1, "%s: byte %u past end of file is 0x%x",
+			     what, i, (unsigned char)p[i]);
+		}
+	}
+}
+
+static
+void
+test_contents(void)
+{
+	struct vmstat before, after;
+	char *p;
+	int fd;
+
+	printf("mmaptest: mapped contents match read()\n");
+
+	if (vmstat(&before) < 0) {
+		err(1, "vmstat");
+	}
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", FILENAME);
+	}
+
+	p = mapfile(fd, PROT_READ, MAP_SHARED);
+	checkmapping("MAP_SHARED", p);
+	unmapfile(p);
+
+	/* a second mapping of the same file comes from the cache too */
+	p = mapfile(fd, PROT_READ, MAP_PRIVATE);
+	checkmapping("MAP_PRIVATE", p);
+	unmapfile(p);
+
+	close(fd);
+
+	if (vmstat(&after) < 0) {
+		err(1, "vmstat");
+	}
+	if (after.vms_count[VMS_PAGECACHE] == before.vms_count[VMS_PAGECACHE]) {
+		errx(1, "vmstat shows no pages mapped from the page cache");
+	}
+}
+
+static
+void
+test_private(void)
+{
+	char *p;
+	int fd;
+
+	printf("mmaptest: private writes stay out of the file\n");
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", FILENAME);
+	}
+	p = mapfile(fd, PROT_READ|PROT_WRITE, MAP_PRIVATE);
+	close(fd);
+
+	/* the mapping outlives the descriptor */
+	checkmapping("MAP_PRIVATE after close", p);
+
+	memset(p + PAGE_SIZE, 'x', PAGE_SIZE);
+	p[FILESIZE - 1] = 'y';
+	if (p[PAGE_SIZE] != 'x' || p[2 * PAGE_SIZE - 1] != 'x' ||
+	    p[FILESIZE - 1] != 'y') {
+		errx(1, "MAP_PRIVATE: writes did not stick");
+	}
+	if (memcmp(p, filedata, PAGE_SIZE) != 0) {
+		errx(1, "MAP_PRIVATE: unwritten page changed");
+	}
+
+	readfile(readback);
+	if (memcmp(readback, filedata, FILESIZE) != 0) {
+		errx(1, "MAP_PRIVATE: writes reached the file");
+	}
+
+	unmapfile(p);
+
+	/* and a fresh mapping doesn't see them either */
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", FILENAME);
+	}
+	p = mapfile(fd, PROT_READ, MAP_PRIVATE);
+	close(fd);
+	checkmapping("MAP_PRIVATE after private writes", p);
+	unmapfile(p);
+}
+
+static
+void
+expect_munmap(void *p, size_t len, const char *desc)
+{
+	if (munmap(p, len) == 0) {
+		errx(1, "munmap(%s): no error", desc);
+	}
+	if (errno != EINVAL) {
+		err(1, "munmap(%s): wrong error", desc);
+	}
+}
+
+static
+void
+test_munmap(void)
+{
+	char *p;
+	int fd;
+
+	printf("mmaptest: munmap only takes whole mappings\n");
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", FILENAME);
+	}
+	p = mapfile(fd, PROT_READ, MAP_PRIVATE);
+	close(fd);
+
+	expect_munmap(p, PAGE_SIZE, "first page");
+	expect_munmap(p + PAGE_SIZE, FILESIZE - PAGE_SIZE, "tail");
+	expect_munmap(p + 1, FILESIZE - 1, "unaligned");
+	expect_munmap(p, 0, "zero length");
+
+	/* still mapped after all that */
+	checkmapping("after failed munmap", p);
+
+	unmapfile(p);
+	expect_munmap(p, FILESIZE, "already unmapped");
+	expect_munmap(&filedata, PAGE_SIZE, "not a mapping");
+}
+
+static
+void
+expect_madvise(void *p, size_t len, int advice, int wanterr,
+	       const char *desc)
+{
+	if (madvise(p, len, advice) == 0) {
+		errx(1, "madvise(%s): no error", desc);
+	}
+	if (errno != wanterr) {
+		err(1, "madvise(%s): wrong error", desc);
+	}
+}
+
+static
+void
+test_madvise(void)
+{
+	char *p;
+	int fd;
+
+	printf("mmaptest: madvise sets up a mapping's fault-around\n");
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", FILENAME);
+	}
+	p = mapfile(fd, PROT_READ, MAP_PRIVATE);
+	close(fd);
+
+	if (madvise(p, FILESIZE, MADV_RANDOM) < 0) {
+		err(1, "madvise(MADV_RANDOM)");
+	}
+	checkmapping("MADV_RANDOM", p);
+	if (madvise(p, FILESIZE, MADV_NORMAL) < 0) {
+		err(1, "madvise(MADV_NORMAL)");
+	}
+
+	expect_madvise(p, FILESIZE, 99, EINVAL, "unknown advice");
+	expect_madvise(p + 1, PAGE_SIZE, MADV_NORMAL, EINVAL, "unaligned");
+	expect_madvise(p, 0, MADV_NORMAL, EINVAL, "zero length");
+
+	unmapfile(p);
+	expect_madvise(p, FILESIZE, MADV_NORMAL, ENOMEM, "unmapped");
+}
+
+static
+void
+expect_mmap(size_t len, int prot, int flags, int fd, off_t offset,
+	    int wanterr, const char *desc)
+{
+	void *p;
+
+	p = mmap(NULL, len, prot, flags, fd, offset);
+	if (p != MAP_FAILED) {
+		errx(1, "mmap(%s): no error", desc);
+	}
+	if (errno != wanterr) {
+		err(1, "mmap(%s): wrong error", desc);
+	}
+}
+
+static
+void
+test_badargs(void)
+{
+	int fd, wfd;
+
+	printf("mmaptest: bad arguments are rejected\n");
+
+	fd = open(FILENAME, O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s: open", FILENAME);
+	}
+	wfd = open(FILENAME, O_WRONLY);
+	if (wfd < 0) {
+		err(1, "%s: open for write", FILENAME);
+	}
+
+	expect_mmap(FILESIZE, PROT_READ, MAP_PRIVATE, -1, 0,
+		    EBADF, "fd -1");
+	expect_mmap(FILESIZE, PROT_READ, MAP_PRIVATE, 1000, 0,
+		    EBADF, "fd 1000");
+	expect_mmap(FILESIZE, PROT_READ, MAP_PRIVATE, wfd, 0,
+		    EACCES, "write-only fd");
+	expect_mmap(FILESIZE, PROT_READ|0x40, MAP_PRIVATE, fd, 0,
+		    EINVAL, "unknown prot bit");
+	expect_mmap(FILESIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0,
+		    ENOTSUP, "writable shared");
+	expect_mmap(FILESIZE, PROT_READ, 0, fd, 0,
+		    EINVAL, "no flags");
+	expect_mmap(FILESIZE, PROT_READ, MAP_SHARED|MAP_PRIVATE, fd, 0,
+		    EINVAL, "both flags");
+	expect_mmap(0, PROT_READ, MAP_PRIVATE, fd, 0,
+		    EINVAL, "zero length");
+	expect_mmap(FILESIZE, PROT_READ, MAP_PRIVATE, fd, 100,
+		    EINVAL, "unaligned offset");
+	expect_mmap(FILESIZE, PROT_READ, MAP_PRIVATE, fd, -PAGE_SIZE,
+		    EINVAL, "negative offset");
+
+	close(wfd);
+	close(fd);
+
+	/* a closed descriptor is as bad as one never opened */
+	expect_mmap(FILESIZE, PROT_READ, MAP_PRIVATE, fd, 0,
+		    EBADF, "closed fd");
+}
+
+int
+main(void)
+{
+	makefile();
+	test_contents();
+	test_private();
+	test_munmap();
+	test_madvise();
+	test_badargs();
+
+	if (remove(FILENAME) < 0) {
+		err(1, "%s: remove", FILENAME);
+	}
+	printf("mmaptest: passed\n");
+	return 0;
+}